@@ -0,0 +1,53 @@
+#ifndef CELL_BATTLES_BATCH_RUNNER_H
+#define CELL_BATTLES_BATCH_RUNNER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "ctpl_stl.h"
+#include "team_stats.h"
+#include "world_settings.h"
+
+// A world to run: steps steps of delta seconds from a new world with settings and seed
+struct BatchJob
+{
+    WorldSettings settings;
+    int seed;
+    int steps;
+    float delta;
+};
+
+struct BatchResult
+{
+    int seed;
+    std::vector<TeamStats> teams;
+    uint64_t stateHash;
+    // Wall time spent constructing or resetting the world and stepping it
+    double seconds;
+};
+
+// Runs many worlds at once on one pool of threads, for sweeps over seeds and settings.
+//
+// Each thread steps one world at a time, taking the next job as soon as it finishes one, so long and short runs even
+// out. Threads keep their world for the next job with the same settings, resetting it instead of allocating another.
+// Worlds run their phases on the runner's pool, so once fewer jobs are left than threads, the threads without a world
+// steal tasks from the steps of those still running, and every core stays busy to the last job.
+class BatchRunner
+{
+    ctpl::thread_pool pool;
+
+public:
+    // Runs jobs on numThreads threads, counting the thread calling run. 0 uses every hardware thread.
+    explicit BatchRunner(int numThreads = 0);
+
+    BatchRunner(const BatchRunner&) = delete;
+
+    // Runs every job and returns their results in job order. Job settings' numThreads is ignored: every world
+    // shares the runner's threads.
+    std::vector<BatchResult> run(const std::vector<BatchJob>& jobs);
+
+    // Writes the final per-team stats of every result as CSV, one row per team, after a header row.
+    static void writeCsv(FILE* file, const std::vector<BatchResult>& results);
+};
+
+#endif //CELL_BATTLES_BATCH_RUNNER_H
@@ -0,0 +1,81 @@
+#ifndef CELL_BATTLES_CELL_STORE_H
+#define CELL_BATTLES_CELL_STORE_H
+
+#include <vector>
+#include <cstdint>
+#include <SFML/System.hpp>
+#include "cell.h"
+
+// Stable identifier for a cell. Valid until the cell is removed, after which it may be handed out again.
+typedef uint32_t CellHandle;
+
+// Structure-of-arrays storage for every cell in a world. Live cells occupy indices [0, size()) of each
+// field, so per-cell passes stream linearly over memory. Removal compacts the arrays in place, so indices
+// are only stable between removals; use handles to refer to a cell across removals.
+class CellStore
+{
+    std::vector<uint32_t> handleToIndex;
+    std::vector<CellHandle> freeHandles;
+
+    template<class F>
+    void forEachField(F f)
+    {
+        f(handle);
+        f(teamId);
+        f(seed);
+        f(attack);
+        f(defense);
+        f(speed);
+        f(metabolism);
+        f(health);
+        f(supply);
+        f(childProgress);
+        f(numChildren);
+        f(velocity);
+        f(preferredVelocity);
+        f(position);
+        f(chunkSlot);
+    }
+
+public:
+    std::vector<CellHandle> handle;
+    std::vector<int> teamId;
+    std::vector<int> seed;
+
+    std::vector<float> attack;
+    std::vector<float> defense;
+    std::vector<float> speed;
+    std::vector<float> metabolism;
+
+    std::vector<float> health;
+    std::vector<float> supply;
+    std::vector<float> childProgress;
+    std::vector<int> numChildren;
+    std::vector<sf::Vector2f> velocity;
+    std::vector<sf::Vector2f> preferredVelocity;
+    std::vector<sf::Vector2f> position;
+
+    // Index of the cell's handle in the list of its chunk and team, so it can be removed without a search.
+    // Maintained by World.
+    std::vector<uint32_t> chunkSlot;
+
+    size_t size() const
+    { return handle.size(); }
+
+    uint32_t indexOf(CellHandle h) const
+    { return handleToIndex[h]; }
+
+    // Appends a cell and returns its handle. The cell's index is size() - 1 until the next removal.
+    CellHandle add(const Cell& cell);
+
+    // Discards every cell and makes room for count new ones with handles equal to their indices. The other fields
+    // are zeroed, to be filled in column by column.
+    void reset(size_t count);
+
+    // Removes every cell with health <= 0 at index first or later in a single pass, keeping survivors in their
+    // relative order.
+    void removeDead(size_t first);
+};
+
+
+#endif //CELL_BATTLES_CELL_STORE_H
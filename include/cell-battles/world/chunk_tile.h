@@ -0,0 +1,74 @@
+#ifndef CELL_BATTLES_CHUNK_TILE_H
+#define CELL_BATTLES_CHUNK_TILE_H
+
+#include <cstdint>
+#include <vector>
+#include <SFML/System.hpp>
+#include "cell_store.h"
+
+// Chunks are stored in square tiles of CHUNK_TILE_SIZE chunks a side
+#define CHUNK_TILE_BITS 5
+#define CHUNK_TILE_SIZE (1 << CHUNK_TILE_BITS)
+#define CHUNK_TILE_AREA (CHUNK_TILE_SIZE * CHUNK_TILE_SIZE)
+
+// Direction a team's cells in a chunk steer towards, for cells that need supply and those that don't
+struct Steering
+{
+    sf::Vector2f needSupply;
+    sf::Vector2f noNeedSupply;
+};
+
+// State of the chunks of one tile. Per-chunk fields are indexed by the chunk's place in the tile,
+// x + y * CHUNK_TILE_SIZE, and per-team fields by that index * numTeams + teamId.
+//
+// World only allocates the tiles where something has happened: a team claimed part of a chunk, borders one, or a cell
+// entered one. Every chunk of the other tiles is unowned, undeveloped, holds no supply and no cells.
+class ChunkTile
+{
+    friend class World;
+    friend class ReplayRecorder;
+
+    int numTeams;
+
+    float supply[CHUNK_TILE_AREA];
+    float development[CHUNK_TILE_AREA];
+    // Team fully owning each chunk, or -1. Kept current by World::setOwnership.
+    int owner[CHUNK_TILE_AREA];
+    // Team bitmasks, bit teamId set if the team owns the chunk fully (full) or at all (claimed). Kept current by
+    // World::setOwnership.
+    uint64_t full[CHUNK_TILE_AREA];
+    uint64_t claimed[CHUNK_TILE_AREA];
+    // Teams for which the chunk is claimable or an edge, derived from the neighbors' full by World::updateChunkMasks
+    uint64_t claimable[CHUNK_TILE_AREA];
+    uint64_t edge[CHUNK_TILE_AREA];
+    // Supply asked of each chunk, only nonzero between World::spendCellSupply and World::shareChunkSupply
+    float demand[CHUNK_TILE_AREA];
+    // Whether the chunk is in World::activeChunks
+    bool active[CHUNK_TILE_AREA];
+    // Whether the chunk is queued in its overlay tile's dirtyTerritories
+    bool territoryDirty[CHUNK_TILE_AREA];
+
+    std::vector<float> ownership;
+
+    // Cells of each team in each chunk, and their steering, stamped with World::steeringEpoch when computed. Empty
+    // until a cell first enters the tile.
+    std::vector<std::vector<CellHandle>> cells;
+    std::vector<Steering> steering;
+    std::vector<uint32_t> steeringStamp;
+
+public:
+    explicit ChunkTile(int numTeams);
+
+    ChunkTile(const ChunkTile&) = delete;
+
+    // Returns the teamId of the team who fully owns the chunk at index. -1 if not fully owned by any team.
+    int getCurrentOwner(int index) const;
+
+    // Sizes the cell lists and steering if they aren't already.
+    void allocateCells();
+
+    // Returns every chunk to its untouched state, keeping the buffers of the cell lists.
+    void clear();
+};
+
+#endif //CELL_BATTLES_CHUNK_TILE_H
@@ -0,0 +1,42 @@
+#ifndef CELL_BATTLES_FRAME_EXCHANGE_H
+#define CELL_BATTLES_FRAME_EXCHANGE_H
+
+#include <array>
+#include <atomic>
+#include "world_frame.h"
+
+// Hands the latest WorldFrame from the thread stepping a world to the thread drawing it, without locks and without
+// either ever waiting on the other. Three frames rotate between them: the writer fills one, the reader draws another,
+// and the third holds the last frame published. Publishing swaps the writer's frame with the third, and acquiring
+// swaps the reader's with it if it is newer, so the reader always gets the latest complete frame and a slow reader
+// only makes the writer overwrite frames it never saw.
+//
+// Exactly one thread may write and one read.
+class FrameExchange
+{
+    // Set in middle when it holds a frame the reader hasn't taken
+    static constexpr int FRESH = 4;
+
+    std::array<WorldFrame, 3> frames;
+    std::atomic<int> middle{1};
+    int back = 0;
+    int front = 2;
+
+public:
+    // Frame for the writer to fill. It keeps whatever it held when it was last published, so captures into it can
+    // reuse its buffers.
+    WorldFrame& getBackFrame()
+    { return frames[back]; }
+
+    // Publishes the back frame, replacing the last one published if the reader hasn't taken it.
+    void publish();
+
+    // True if the reader took the last frame published, or none was.
+    bool wasTaken() const;
+
+    // Takes the latest frame published, or returns the one taken before if there is no newer one. The frame stays
+    // untouched until the next call.
+    const WorldFrame& acquire();
+};
+
+#endif //CELL_BATTLES_FRAME_EXCHANGE_H
@@ -0,0 +1,44 @@
+#ifndef CELL_BATTLES_FRAME_RENDERER_H
+#define CELL_BATTLES_FRAME_RENDERER_H
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <vector>
+#include "world_frame.h"
+
+// Draws WorldFrames, keeping a texture for each overlay tile it has drawn. Textures are only updated where a frame's
+// pixels differ from what was uploaded last, so drawing frames of a slowly changing world uploads little.
+class FrameRenderer
+{
+    struct OverlayTexture
+    {
+        sf::Texture texture;
+        // Mirrors the texture
+        std::vector<sf::Uint8> pixels;
+        // Version of the frame tile last uploaded, 0 before the first upload
+        uint64_t version = 0;
+    };
+
+    std::vector<OverlayTexture> overlayTextures;
+    std::vector<sf::Uint8> uploadBuffer;
+
+    // Triangles for every cell in view, rebuilt each draw and submitted in a single draw call
+    std::vector<sf::Vertex> cellVertices;
+
+    // Brings the texture of overlay tile index up to date with the frame's pixels, creating it if needed.
+    void uploadOverlayTile(const WorldFrame::OverlayTile& tile, int index);
+
+    void drawCells(sf::RenderTarget& target, const WorldFrame& frame, sf::RenderStates states,
+                   sf::FloatRect visibleArea);
+
+public:
+    // The part of the world target's view shows, given in world units. World units map to target coordinates
+    // through transform. Rotated views get the bounds of what they show.
+    static sf::FloatRect getVisibleArea(const sf::RenderTarget& target, const sf::Transform& transform);
+
+    // Draws the part of frame in the target's view. Tiles in view but outside the captured area keep what their
+    // texture last showed.
+    void draw(sf::RenderTarget& target, const WorldFrame& frame, sf::RenderStates states = sf::RenderStates::Default);
+};
+
+#endif //CELL_BATTLES_FRAME_RENDERER_H
@@ -0,0 +1,24 @@
+#ifndef CELL_BATTLES_RANDOM_H
+#define CELL_BATTLES_RANDOM_H
+
+#include <cstdint>
+
+// SplitMix64 generator. Unlike the standard engines and distributions its output is the same with every compiler
+// and standard library, and independent streams can be derived from any (seed, stream, index) key.
+class Random
+{
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed, uint64_t stream = 0, uint64_t index = 0);
+
+    uint64_t next();
+
+    // Uniform in [min, max)
+    float uniform(float min, float max);
+
+    // Uniform in [min, max]
+    int uniformInt(int min, int max);
+};
+
+#endif //CELL_BATTLES_RANDOM_H
@@ -0,0 +1,100 @@
+#ifndef CELL_BATTLES_REPLAY_H
+#define CELL_BATTLES_REPLAY_H
+
+#include <cstdint>
+#include <vector>
+
+// File layout of replays written by ReplayRecorder and read by ReplayPlayer. A ReplayHeader and the RGBA color of
+// every team are followed by segments, each a ReplaySegmentHeader and its frames compressed with zlib. The first
+// frame of a segment is a keyframe holding the whole state, the others only what changed since the frame before,
+// so a reader can start at any segment and the file can be read while it is still being written. Header fields are
+// stored in the writer's byte order, which the header records; files from the other byte order are rejected.
+//
+// A frame is the world as ReplayRecorder::record saw it, normally right after a step, made of:
+//  - The world time, as the 4 bytes of a float, least significant first.
+//  - The cells as a varint count, then each cell in handle order. Handles are stored as the gap from the previous
+//    one (minus one). In keyframes, each handle is followed by the team, the position and a health byte. In other
+//    frames, the gap is shifted left by one with the low bit set for cells that weren't in the frame before or were
+//    of another team, which are stored the same way; the others store the change in position and health since
+//    then. Positions and changes are zigzag encoded.
+//  - The chunks as a varint count, then each chunk by its row-major index as a gap from the previous one (minus
+//    one), followed by one ownership byte per team. Keyframes hold every chunk any team owns part of, other frames
+//    the chunks whose ownership changed.
+//
+// Positions are quantized to 1 / positionScale world units and health and ownership to 1 / 255. Only exactly none
+// and all of it are stored as 0 and 255, anything between is kept to 1 to 254, so a chunk is fully owned or claimed
+// in a replay exactly when it was in the world. Varints are unsigned LEB128.
+
+#define REPLAY_MAGIC "CBREPLAY"
+#define REPLAY_VERSION 2
+#define REPLAY_BYTE_ORDER 0x01020304u
+
+struct ReplayHeader
+{
+    // REPLAY_MAGIC, without its terminating 0
+    char magic[8];
+    uint32_t version;
+    // REPLAY_BYTE_ORDER as written
+    uint32_t byteOrder;
+
+    int32_t width;
+    int32_t height;
+    int32_t numChunksX;
+    int32_t numChunksY;
+    float pixelsPerChunk;
+    float cellRadius;
+    int32_t numTeams;
+    // Quantized positions per world unit
+    int32_t positionScale;
+    // Frames per segment, except maybe the last
+    int32_t keyframeInterval;
+    uint32_t padding;
+};
+
+struct ReplaySegmentHeader
+{
+    // Bytes of compressed frames following the header, and their size once decompressed
+    uint32_t compressedSize;
+    uint32_t rawSize;
+    // Index of the segment's first frame in the replay, and the number of frames it holds
+    uint32_t firstFrame;
+    uint32_t numFrames;
+    // More than the largest cell handle in the segment's frames. Readers reject larger handles as corrupt.
+    uint32_t handleCapacity;
+};
+
+inline void writeVarint(std::vector<unsigned char>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char) value);
+}
+
+// Reads a varint at in and moves in past it. Returns false if it runs past end.
+inline bool readVarint(const unsigned char*& in, const unsigned char* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; in != end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *in++;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Maps small magnitudes of either sign to small unsigned values: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+inline uint64_t zigzagEncode(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+#endif //CELL_BATTLES_REPLAY_H
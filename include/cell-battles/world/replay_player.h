@@ -0,0 +1,133 @@
+#ifndef CELL_BATTLES_REPLAY_PLAYER_H
+#define CELL_BATTLES_REPLAY_PLAYER_H
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "replay.h"
+#include "team_stats.h"
+#include "world_frame.h"
+
+// Plays back replays written by ReplayRecorder. Any frame can be sought to, in either direction: the segment holding
+// it is read and decoded whole, so moving within a segment only walks its decoded frames, and moving to another
+// starts from its keyframe. Only the territory overlay is recorded, so frames are captured as in the DEFAULT view
+// mode, and team stats only hold cell counts and owned chunks.
+class ReplayPlayer
+{
+    struct Segment
+    {
+        // Of the compressed frames, past the header
+        std::streamoff offset;
+        ReplaySegmentHeader header;
+    };
+
+    // A decoded frame, pointing into the cell and chunk arrays of its segment
+    struct Frame
+    {
+        float worldTime;
+        size_t firstCell;
+        size_t numCells;
+        size_t firstChange;
+        size_t numChanges;
+    };
+
+    struct DecodedSegment
+    {
+        std::vector<Frame> frames;
+        std::vector<sf::Vector2f> cellPositions;
+        std::vector<sf::Color> cellColors;
+        // Cells of each team in each frame, numTeams per frame
+        std::vector<int> teamCellCounts;
+        // Row-major index of every chunk whose ownership a frame sets, and 2 * numTeams bytes for each: the
+        // ownership it sets, then the ownership before. The keyframe's changes only hold the chunks anyone owns part
+        // of.
+        std::vector<int> changeChunks;
+        std::vector<uint8_t> changeBytes;
+    };
+
+    // A cell as last decoded, by handle
+    struct DecodedCell
+    {
+        int32_t x;
+        int32_t y;
+        uint8_t team;
+        uint8_t health;
+        // Frame of the segment it was last decoded in, plus 1. 0 if it never was.
+        uint32_t frame;
+    };
+
+    std::ifstream file;
+    std::string path;
+    ReplayHeader header{};
+    std::vector<sf::Color> teamColors;
+    std::vector<Segment> segments;
+    uint32_t numFrames = 0;
+
+    // Index of the segment in loaded, or -1, and the frame of the replay the state below is at
+    int loadedSegment = -1;
+    uint32_t currentFrame = 0;
+    DecodedSegment loaded;
+
+    // Ownership bytes at currentFrame, numTeams per chunk in row-major order, the overlay they color, and the chunks
+    // each team owns fully
+    std::vector<uint8_t> ownership;
+    sf::Vector2i numOverlayTiles;
+    std::vector<WorldFrame::OverlayTile> overlayTiles;
+    std::vector<int> ownedChunks;
+
+    // Scratch of loadSegment, which decodes into decoding and swaps it with loaded once it succeeds
+    DecodedSegment decoding;
+    std::vector<unsigned char> compressed;
+    std::vector<unsigned char> raw;
+    std::vector<DecodedCell> decodedCells;
+    std::vector<uint8_t> decodedOwnership;
+
+    // Reads and decodes a segment into loaded, leaving the ownership and overlay as they were. Returns false, leaving
+    // loaded as it was too, if the segment can't be read or is corrupt.
+    bool loadSegment(int index);
+
+    // Decodes frame, counted from the start of its segment, from in and moves in past it. Returns false if the frame
+    // is corrupt, including if it holds a handle of handleCapacity or more.
+    bool decodeFrame(const unsigned char*& in, const unsigned char* end, uint32_t frame, uint32_t handleCapacity);
+
+    // Sets the ownership of every chunk to that of loaded's keyframe.
+    void applyKeyframe();
+
+    // Sets the ownership of a chunk, updating its overlay pixel and the owned chunk counts.
+    void setOwnership(int chunk, const uint8_t* teamOwnership);
+
+    // Moves the ownership and overlay from frame `from` of loaded to frame `to` by applying or reverting the changes
+    // in between. Both count from the start of the segment.
+    void applyChanges(uint32_t from, uint32_t to);
+
+public:
+    ReplayPlayer() = default;
+
+    ReplayPlayer(const ReplayPlayer&) = delete;
+
+    // Opens the replay at path and seeks to its first frame. A segment cut short at the end of the file, as left by a
+    // recording still running, is ignored. Returns false if the file can't be read or isn't a replay.
+    bool open(const std::string& path);
+
+    uint32_t getNumFrames() const;
+
+    // Frame the player is at, from 0 to getNumFrames() - 1
+    uint32_t getFrame() const;
+
+    float getWorldTime() const;
+
+    // Stats of each team at the current frame, like World::getTeamStats but only with cell counts and owned chunks
+    std::vector<TeamStats> getTeamStats() const;
+
+    // Moves to frame, clamped to the replay. Returns false if the segment holding it couldn't be read, in which case
+    // the player stays where it was.
+    bool seek(int64_t frame);
+
+    // Fills frame with what drawing area, given in world units, needs at the current frame, like
+    // World::captureFrame.
+    void captureFrame(WorldFrame& frame, sf::FloatRect area) const;
+};
+
+#endif //CELL_BATTLES_REPLAY_PLAYER_H
@@ -0,0 +1,81 @@
+#ifndef CELL_BATTLES_REPLAY_RECORDER_H
+#define CELL_BATTLES_REPLAY_RECORDER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class World;
+
+// Writes a world's cells and chunk ownership as frames of a replay, in the format described in replay.h. Frames are
+// gathered in memory and compressed a segment at a time, so a recording costs a few bytes per cell per step.
+class ReplayRecorder
+{
+public:
+    // Frames per segment unless given otherwise, 2 seconds at 60 steps a second
+    static constexpr int DEFAULT_KEYFRAME_INTERVAL = 120;
+
+    // Quantized positions per world unit
+    static constexpr int POSITION_SCALE = 64;
+
+private:
+    // A cell as last written, by handle
+    struct RecordedCell
+    {
+        int32_t x;
+        int32_t y;
+        uint8_t team;
+        uint8_t health;
+        // Frame it was last written in, plus 1. 0 if it never was.
+        uint32_t frame;
+    };
+
+    FILE* file = nullptr;
+    std::string path;
+    int numTeams = 0;
+    int numChunksX = 0;
+    int keyframeInterval = 1;
+
+    uint32_t numFrames = 0;
+    uint32_t segmentFrames = 0;
+    std::vector<unsigned char> segment;
+    std::vector<unsigned char> compressed;
+
+    std::vector<RecordedCell> cells;
+    std::vector<RecordedCell> currentCells;
+    // Ownership bytes last written, numTeams per chunk in row-major order
+    std::vector<uint8_t> ownership;
+    // Scratch of record
+    std::vector<int> changedChunks;
+    std::vector<uint8_t> chunkOwnership;
+
+    void recordCells(const World& world, bool keyframe);
+
+    void recordChunks(const World& world, bool keyframe);
+
+    // Compresses the frames gathered since the last segment and appends them to the file.
+    bool writeSegment();
+
+public:
+    ReplayRecorder() = default;
+
+    ReplayRecorder(const ReplayRecorder&) = delete;
+
+    // Closes the file, writing any frames still gathered.
+    ~ReplayRecorder();
+
+    // Creates the replay at path for world and writes its header. Frames are grouped in segments of keyframeInterval,
+    // the distance between the points a player can start from. Returns false if the file can't be created.
+    bool open(const std::string& path, const World& world, int keyframeInterval = DEFAULT_KEYFRAME_INTERVAL);
+
+    // Appends the world's current state as the next frame. Call right after opening and after every World::step:
+    // ownership changes are taken from the last step, so changes from anything else only show from the next
+    // keyframe. Returns false if the file couldn't be written, after which nothing more is recorded.
+    bool record(const World& world);
+
+    // Writes the frames still gathered and closes the file. Returns false if they couldn't be written.
+    bool close();
+};
+
+#endif //CELL_BATTLES_REPLAY_RECORDER_H
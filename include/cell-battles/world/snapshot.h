@@ -0,0 +1,60 @@
+#ifndef CELL_BATTLES_SNAPSHOT_H
+#define CELL_BATTLES_SNAPSHOT_H
+
+#include <cstdint>
+
+// File layout of World snapshots. A SnapshotHeader is followed by one raw array per section, each starting at a
+// 16 byte aligned offset given by the header, so a loader can map the file and copy arrays out whole. Values are
+// stored in the writer's byte order, which the header records; files from the other byte order are rejected.
+
+#define SNAPSHOT_VERSION 1
+
+enum SnapshotSection
+{
+    // Per chunk, row by row (x + y * numChunksX). Ownership holds numTeams floats per chunk.
+    SNAPSHOT_OWNERSHIP,
+    SNAPSHOT_SUPPLY,
+    SNAPSHOT_SUPPLY_GENERATION,
+    SNAPSHOT_DEVELOPMENT,
+
+    // Per cell, in CellStore order, matching the CellStore fields
+    SNAPSHOT_TEAM_ID,
+    SNAPSHOT_SEED,
+    SNAPSHOT_ATTACK,
+    SNAPSHOT_DEFENSE,
+    SNAPSHOT_SPEED,
+    SNAPSHOT_METABOLISM,
+    SNAPSHOT_HEALTH,
+    SNAPSHOT_CELL_SUPPLY,
+    SNAPSHOT_CHILD_PROGRESS,
+    SNAPSHOT_NUM_CHILDREN,
+    SNAPSHOT_VELOCITY,
+    SNAPSHOT_PREFERRED_VELOCITY,
+    SNAPSHOT_POSITION,
+
+    NUM_SNAPSHOT_SECTIONS
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    // 0x01020304 as written
+    uint32_t byteOrder;
+
+    int32_t numChunksX;
+    int32_t numChunksY;
+    int32_t numTeams;
+    float worldTime;
+    // Seed all of the world's random streams derive from
+    uint64_t seed;
+    float maxSupplyGeneration;
+    uint32_t padding;
+    uint64_t numCells;
+
+    // Byte offset from the start of the file and byte size of each section
+    uint64_t sectionOffsets[NUM_SNAPSHOT_SECTIONS];
+    uint64_t sectionSizes[NUM_SNAPSHOT_SECTIONS];
+};
+
+#endif //CELL_BATTLES_SNAPSHOT_H
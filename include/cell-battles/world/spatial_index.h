@@ -0,0 +1,126 @@
+#ifndef CELL_BATTLES_SPATIAL_INDEX_H
+#define CELL_BATTLES_SPATIAL_INDEX_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <SFML/System.hpp>
+#include "cell_store.h"
+#include "trace.h"
+
+// Uniform grid over cell positions for nearest-cell queries. Cells are radix sorted by (bucket, team) so
+// every bucket, and every team within it, is a contiguous run of entries with positions stored alongside.
+// Rebuilding costs O(cells) regardless of world size.
+class SpatialIndex
+{
+    struct Range
+    {
+        uint64_t bucketIndex;
+        size_t begin;
+        size_t end;
+        sf::Vector2f min;
+        sf::Vector2f max;
+    };
+
+    float bucketSize = 1.f;
+    int numTeams = 1;
+    sf::Vector2i numBuckets;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> cellIndices;
+    std::vector<sf::Vector2f> positions;
+
+    std::vector<uint64_t> keyScratch;
+    std::vector<uint32_t> indexScratch;
+    std::vector<uint32_t> histogram;
+
+    sf::Vector2i getBucket(sf::Vector2f position) const;
+
+    uint64_t getKey(sf::Vector2i bucket, int teamId) const
+    { return ((uint64_t) bucket.y * (uint64_t) numBuckets.x + (uint64_t) bucket.x) * (uint64_t) numTeams + teamId; }
+
+    size_t lowerBound(size_t begin, size_t end, uint64_t key) const
+    { return std::lower_bound(keys.begin() + begin, keys.begin() + end, key) - keys.begin(); }
+
+    // Collects the runs of the buckets within one bucket of center. Returns the number of ranges written.
+    int getNeighborRanges(sf::Vector2i center, Range* ranges) const;
+
+    static float distanceSq(sf::Vector2f position, const Range& range);
+
+    // Scans entries [begin, end) for the closest to position, tightening bestDistSq and bestEntry.
+    void scan(size_t begin, size_t end, sf::Vector2f position, float& bestDistSq, int& bestEntry) const;
+
+public:
+    // Sets the grid covering [0, worldSize). Buckets should be at least as large as the largest query distance.
+    void resize(sf::Vector2f worldSize, float bucketSize, int numTeams);
+
+    // Indexes every live cell. Cells with health <= 0 are left out.
+    void rebuild(const CellStore& cells);
+
+    size_t size() const
+    { return keys.size(); }
+
+    // Returns the index of the closest cell within maxDistance that is on teamId (or not on it, if enemies is
+    // set), skipping the cell at exclude. Returns -1 if there is none.
+    int findNearest(sf::Vector2f position, int teamId, bool enemies, float maxDistance, int exclude) const;
+
+    // Finds the closest enemy within maxDistance for the cells at sorted entries [begin, end), calling
+    // f(cellIndex, enemyIndex) for each that has one. Cells sharing a bucket and team share the neighbor lookups.
+    template<class F>
+    void forEachNearestEnemy(size_t begin, size_t end, float maxDistance, F f) const
+    {
+        Range ranges[9];
+        Range enemyRanges[18];
+        float maxDistanceSq = maxDistance * maxDistance;
+        TRACE_ONLY(size_t numCandidates = 0;)
+
+        size_t groupStart = begin;
+        while (groupStart < end)
+        {
+            uint64_t key = keys[groupStart];
+            size_t groupEnd = lowerBound(groupStart, end, key + 1);
+
+            int teamId = (int) (key % numTeams);
+            uint64_t bucketIndex = key / numTeams;
+            sf::Vector2i bucket = {(int) (bucketIndex % numBuckets.x), (int) (bucketIndex / numBuckets.x)};
+
+            // Split each neighboring bucket around the group's own team
+            int numRanges = getNeighborRanges(bucket, ranges);
+            int numEnemyRanges = 0;
+            for (int r = 0; r < numRanges; r++)
+            {
+                Range& range = ranges[r];
+                uint64_t ownKey = range.bucketIndex * numTeams + teamId;
+                size_t ownBegin = lowerBound(range.begin, range.end, ownKey);
+                size_t ownEnd = lowerBound(ownBegin, range.end, ownKey + 1);
+                if (range.begin < ownBegin)
+                    enemyRanges[numEnemyRanges++] = {range.bucketIndex, range.begin, ownBegin, range.min, range.max};
+                if (ownEnd < range.end)
+                    enemyRanges[numEnemyRanges++] = {range.bucketIndex, ownEnd, range.end, range.min, range.max};
+            }
+
+            for (size_t entry = groupStart; entry < groupEnd; entry++)
+            {
+                sf::Vector2f position = positions[entry];
+                float bestDistSq = maxDistanceSq;
+                int bestEntry = -1;
+
+                for (int r = 0; r < numEnemyRanges; r++)
+                {
+                    // Skip buckets that cannot hold anything closer than the current best
+                    if (distanceSq(position, enemyRanges[r]) >= bestDistSq) continue;
+                    TRACE_ONLY(numCandidates += enemyRanges[r].end - enemyRanges[r].begin;)
+                    scan(enemyRanges[r].begin, enemyRanges[r].end, position, bestDistSq, bestEntry);
+                }
+
+                if (bestEntry != -1)
+                    f(cellIndices[entry], cellIndices[bestEntry]);
+            }
+
+            groupStart = groupEnd;
+        }
+        TRACE_COUNTER("candidates", numCandidates);
+    }
+};
+
+#endif //CELL_BATTLES_SPATIAL_INDEX_H
@@ -0,0 +1,108 @@
+#ifndef CELL_BATTLES_STEP_GRAPH_H
+#define CELL_BATTLES_STEP_GRAPH_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "step_phase.h"
+
+class World;
+
+// Parts of the world state the nodes of a StepGraph read and write, as bits of a mask.
+enum StepResource : uint32_t
+{
+    // Cell positions
+    CELL_POSITIONS = 1 << 0,
+    // Cell velocities and preferred velocities
+    CELL_MOTION = 1 << 1,
+    // Cell supply, child progress and number of children
+    CELL_SUPPLY = 1 << 2,
+    // Cell health and the cells killed this step
+    CELL_HEALTH = 1 << 3,
+    // Which cells exist, their handles and their fixed stats
+    CELL_STORE = 1 << 4,
+    // Cell lists of the chunks, cell slots, and the team totals counted from them
+    CHUNK_CELLS = 1 << 5,
+    // Chunks updateTerritories visits
+    ACTIVE_CHUNKS = 1 << 6,
+    // Which chunk tiles are allocated
+    CHUNK_TILES = 1 << 7,
+    // Team ownership of the chunks, their owners and masks, and their overlay colors
+    CHUNK_OWNERSHIP = 1 << 8,
+    CHUNK_DEVELOPMENT = 1 << 9,
+    CHUNK_SUPPLY = 1 << 10,
+    // Supply cells asked their chunks for
+    CHUNK_DEMAND = 1 << 11
+};
+
+#define NUM_STEP_RESOURCES 12
+
+// Name of the resource at bit resource of a StepResource mask.
+const char* getStepResourceName(int resource);
+
+// The work of World::step as a graph of nodes declaring the resources they read and write. Each node runs after every
+// node added before it that it conflicts with, one that writes what it reads or writes or reads what it writes, so
+// nodes that don't conflict may run at once and every order the graph allows ends in the same state.
+//
+// That only holds if the declarations are right, and only writes are checked (see World::checkPhaseAccess). A node
+// reading a resource it doesn't declare may race with a node writing it, and nothing reports it.
+class StepGraph
+{
+public:
+    static constexpr int MAX_NODES = 16;
+
+    struct Node
+    {
+        // World function the node runs, for traces and conflict reports
+        const char* name;
+        // Phase the node's time counts towards
+        StepPhase phase;
+        void (World::*run)(float);
+        uint32_t reads;
+        uint32_t writes;
+        // Nodes that wait for this one, in the order they were added
+        std::vector<int> successors;
+        int numPredecessors = 0;
+    };
+
+private:
+    std::vector<Node> nodes;
+    std::vector<int> roots;
+
+    // Predecessors of each node yet to finish in the current run
+    std::array<std::atomic<int>, MAX_NODES> pending;
+
+    // Nodes running right now, for beginNode to check against
+    std::mutex runningMutex;
+    std::vector<int> running;
+
+public:
+    // Adds a node after the ones added so far. Writing a resource implies reading it.
+    void add(const char* name, StepPhase phase, void (World::*run)(float), uint32_t reads, uint32_t writes);
+
+    int size() const
+    { return (int) nodes.size(); }
+
+    const Node& getNode(int node) const
+    { return nodes[node]; }
+
+    // Nodes without predecessors, in the order they were added
+    const std::vector<int>& getRoots() const
+    { return roots; }
+
+    // Readies the graph for a new run.
+    void reset();
+
+    // Counts one finished predecessor of node. Returns true if it was the last one, so that node can run.
+    bool finishPredecessor(int node);
+
+    // Records that node started and ended running. beginNode aborts, naming both nodes and a resource, if node
+    // conflicts with one still running. The edges come from the same declarations, so this guards the scheduling,
+    // not the declarations.
+    void beginNode(int node);
+    void endNode(int node);
+};
+
+#endif //CELL_BATTLES_STEP_GRAPH_H
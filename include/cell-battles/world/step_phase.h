@@ -0,0 +1,23 @@
+#ifndef CELL_BATTLES_STEP_PHASE_H
+#define CELL_BATTLES_STEP_PHASE_H
+
+// The phases World::step runs, in the order they were written. Phases that share no state may run at once, see
+// World::buildStepGraph.
+enum StepPhase
+{
+    UPDATE_TERRITORIES,
+    DEVELOP_CHUNKS,
+    UPDATE_CHUNK_SUPPLY,
+    UPDATE_CELL_SUPPLY,
+    UPDATE_VELOCITIES,
+    UPDATE_POSITIONS,
+    ATTACK_NEARBY,
+    SPAWN_CHILDREN,
+    NUM_STEP_PHASES
+};
+
+// Name of the World function implementing the phase. UPDATE_CELL_SUPPLY is split between spendCellSupply and
+// shareChunkSupply, so that part of it can run alongside the chunk phases.
+const char* getStepPhaseName(StepPhase phase);
+
+#endif //CELL_BATTLES_STEP_PHASE_H
@@ -0,0 +1,14 @@
+#ifndef CELL_BATTLES_SUPPLY_DIFFUSION_H
+#define CELL_BATTLES_SUPPLY_DIFFUSION_H
+
+// Advances the supply of a size x size block of chunks by one step. supply and owner are row-major grids of
+// (size + 2) x (size + 2) chunks holding the block surrounded by a ring of its neighbors, with owner -1 where the
+// ring leaves the world. generation, development and out are row-major size x size grids of the block alone.
+//
+// Owned chunks exchange supply with 4-neighbors of the same owner through a 5-point Laplacian and gain their
+// effective generation (generation * development). Unowned chunks (owner -1) decay towards zero. Uses SSE2 where
+// available, matching the scalar path bit for bit.
+void diffuseSupply(int size, const float* supply, const int* owner, const float* generation,
+                   const float* development, float diffusionRate, float delta, float* out);
+
+#endif //CELL_BATTLES_SUPPLY_DIFFUSION_H
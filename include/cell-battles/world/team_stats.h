@@ -0,0 +1,17 @@
+#ifndef CELL_BATTLES_TEAM_STATS_H
+#define CELL_BATTLES_TEAM_STATS_H
+
+struct TeamStats
+{
+    int cellCount = 0;
+
+    float averageAttack = 0.f;
+    float averageDefense = 0.f;
+    float averageSpeed = 0.f;
+    float averageMetabolism = 0.f;
+
+    // Number of chunks fully owned by the team
+    int ownedChunks = 0;
+};
+
+#endif //CELL_BATTLES_TEAM_STATS_H
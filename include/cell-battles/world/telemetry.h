@@ -0,0 +1,43 @@
+#ifndef CELL_BATTLES_TELEMETRY_H
+#define CELL_BATTLES_TELEMETRY_H
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "step_phase.h"
+
+class World;
+
+// Appends CSV rows sampled every few steps of a world to a file. Each row holds the run's seed, the step and world
+// time, then for every team its cell count, owned chunks, average stats and total supply, then the nanoseconds
+// spent in each phase since the previous row (zero unless World::timePhases is set).
+class Telemetry
+{
+    FILE* file = nullptr;
+    int numTeams = 0;
+    int interval = 1;
+
+    int seed = 0;
+    uint64_t step = 0;
+    std::array<uint64_t, NUM_STEP_PHASES> lastPhaseTimes = {};
+
+public:
+    Telemetry() = default;
+
+    Telemetry(const Telemetry&) = delete;
+
+    ~Telemetry();
+
+    // Creates the file at path and writes the header row. A row is written every interval steps. Returns false if
+    // the file can't be created.
+    bool open(const std::string& path, int numTeams, int interval);
+
+    // Starts a new run of world, labelling its rows with seed.
+    void beginRun(const World& world, int seed);
+
+    // Counts a step of the current run, writing a row if it falls on the interval. Call after every World::step.
+    void sample(const World& world);
+};
+
+#endif //CELL_BATTLES_TELEMETRY_H
@@ -0,0 +1,79 @@
+#ifndef CELL_BATTLES_TRACE_H
+#define CELL_BATTLES_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// Scoped timing markers for finding out where a slow step or frame went, down to the pool tasks of each phase.
+//
+// TRACE_SCOPE(name) records the time from it to the end of the enclosing block as an event on the calling thread.
+// TRACE_COUNTER(name, value) adds value to a named counter of the innermost open scope on the calling thread, such
+// as the cells or chunks it went through. TRACE_ONLY(...) keeps its arguments only when tracing, for counting.
+// Names must be string literals or otherwise outlive the trace.
+//
+// All three compile to nothing unless CELL_BATTLES_TRACE is defined (cmake -DCELL_BATTLES_TRACE=ON). When it is,
+// every thread appends to its own fixed size ring buffer of events, so recording never locks or allocates and the
+// oldest events are dropped once it wraps.
+#ifdef CELL_BATTLES_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, value) Trace::counter(name, (int64_t) (value))
+#define TRACE_ONLY(...) __VA_ARGS__
+#else
+#define TRACE_SCOPE(name) ((void) 0)
+#define TRACE_COUNTER(name, value) ((void) 0)
+#define TRACE_ONLY(...)
+#endif
+
+class Trace
+{
+public:
+    // Events kept per thread
+    static constexpr uint32_t RING_SIZE = 1 << 15;
+
+    // Counters kept per event. Further counters of the same event are dropped.
+    static constexpr int MAX_COUNTERS = 4;
+
+    // True if this build records events
+    static constexpr bool enabled()
+    {
+#ifdef CELL_BATTLES_TRACE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Opens an event on the calling thread and returns its sequence number there.
+    static uint64_t begin(const char* name);
+
+    // Closes the event begin returned, which must be the innermost one open on the calling thread.
+    static void end(uint64_t event);
+
+    static void counter(const char* name, int64_t value);
+
+    // Writes the events of every thread in the Chrome trace event format, which chrome://tracing and Perfetto open
+    // and Tracy can import. Counters become the args of their event. Threads must not record while this runs.
+    // Returns false if the file could not be written.
+    static bool writeChromeJson(const std::string& path);
+
+    // Drops every recorded event. Threads must not record while this runs.
+    static void clear();
+};
+
+class TraceScope
+{
+    uint64_t event;
+
+public:
+    explicit TraceScope(const char* name) : event(Trace::begin(name))
+    {}
+
+    TraceScope(const TraceScope&) = delete;
+
+    ~TraceScope()
+    { Trace::end(event); }
+};
+
+#endif //CELL_BATTLES_TRACE_H
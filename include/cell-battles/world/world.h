@@ -2,42 +2,223 @@
 #define CELL_BATTLES_WORLD_H
 
 #include <SFML/Graphics.hpp>
-#include "cell.h"
+#include "cell_store.h"
+#include <array>
 #include <list>
-#include <random>
 #include "ctpl_stl.h"
-#include "chunk.h"
+#include "chunk_tile.h"
+#include "frame_renderer.h"
+#include "spatial_index.h"
+#include "step_graph.h"
+#include "step_phase.h"
+#include "team_stats.h"
 #include "view_mode.h"
+#include "world_frame.h"
 #include "world_settings.h"
 
 class World : public sf::Drawable
 {
+    // Reads cells and chunk ownership straight from the store and tiles
+    friend class ReplayRecorder;
+
     WorldSettings settings;
 
-    std::vector<std::unique_ptr<Chunk>> chunks;
+    // Chunk state, in tiles of CHUNK_TILE_SIZE x CHUNK_TILE_SIZE chunks in row-major order. Tiles are allocated by
+    // allocateTile the first time anything happens in them and kept from then on, so memory grows with the area the
+    // game has reached rather than with the map. Unallocated tiles read as emptyTile.
+    sf::Vector2i numTiles;
+    std::vector<std::unique_ptr<ChunkTile>> tiles;
+    std::unique_ptr<ChunkTile> emptyTile;
+    // Indices of the allocated tiles, in allocation order
+    std::vector<int> allocatedTiles;
+    // Cleared tiles released by reset, reused by allocateTile
+    std::vector<std::unique_ptr<ChunkTile>> spareTiles;
+
+    // Supply generation of every chunk, indexed by getChunkIndex. The only per-chunk array covering the whole map:
+    // it is drawn from a single stream in row order, so it can't be made up when a tile is allocated.
+    std::vector<float> chunkSupplyGeneration;
     float maxSupplyGeneration = -1.f;
-    std::list<std::shared_ptr<Cell>> cells;
+
+    // Scratch of updateChunkSupply: a tile's supply and owners with a ring of its neighbors, and the new supply of
+    // every allocated tile
+    std::vector<float> paddedSupply;
+    std::vector<int> paddedOwner;
+    std::vector<float> supplyBuffer;
+
+    CellStore cells;
     float worldTime = 0;
 
-    std::default_random_engine generator;
+    // Every random stream of the world is derived from this, see Random
+    uint64_t seed;
+
+    // Pool the world's phases run on: its own, or one it borrows from whoever built it
+    std::unique_ptr<ctpl::thread_pool> ownedPool;
+    ctpl::thread_pool& pool;
+
+    struct CellMove
+    {
+        uint32_t index;
+        sf::Vector2i from;
+        sf::Vector2i to;
+    };
+
+    struct CellDamage
+    {
+        uint32_t target;
+        float amount;
+    };
+
+    // Per-task output of the parallel phases. Applying the buffers in task order reproduces the serial result.
+    std::vector<std::vector<CellMove>> moveBuffers;
+    std::vector<std::vector<CellDamage>> damageBuffers;
+
+    // (chunk, team) pairs holding cells, as chunkIndex * numTeams + teamId. updateVelocities computes the
+    // ChunkTile::steering of each, stamping it with steeringEpoch.
+    std::vector<uint32_t> steeringPairs;
+    uint32_t steeringEpoch = 0;
+
+    // Indices of the cells killed since the last removeKilledCells
+    std::vector<uint32_t> killBuffer;
+
+    // Cells bucketed by position and team for nearest-enemy searches. Rebuilt by attackNearby.
+    SpatialIndex spatialIndex;
+
+    // Overlay drawn under the cells, one pixel per chunk, split into square tiles of OVERLAY_TILE_CHUNKS chunks so
+    // that only the tiles in view are kept current and captured. A tile's pixels are created the first time it is in
+    // view.
+    struct OverlayTile
+    {
+        // One RGBA pixel per chunk, rows of width pixels
+        std::vector<sf::Uint8> pixels;
+        int width = 0;
+        // Chunks of the tile whose territory color is stale. Only tracked once the tile has pixels, so headless
+        // runs never pay for them.
+        std::vector<sf::Vector2i> dirtyTerritories;
+        // View mode the pixels were colored for, -1 if they must all be recolored
+        int mode = -1;
+        // Bumped whenever a pixel changes, so frames only copy the tiles that changed since they last did. Never
+        // reset, so a frame can't mistake new pixels for ones it holds.
+        uint64_t version = 0;
+    };
+
+    mutable std::vector<OverlayTile> overlayTiles;
+    sf::Vector2i numOverlayTiles;
+
+    // What draw captures and draws, kept between draws to reuse their buffers and textures
+    mutable WorldFrame drawFrame;
+    mutable FrameRenderer renderer;
+
+    struct OwnershipUpdate
+    {
+        int index;
+        int teamId;
+        float ownership;
+    };
+
+    // Changes computed by updateTerritories, applied after every chunk has been visited
+    std::vector<OwnershipUpdate> ownershipUpdates;
+    // Per-team scratch of updateTerritories
+    std::vector<uint32_t> territoryCellCounts;
+    std::vector<float> territoryTargets;
+
+    // Supply each cell asks its chunk for in spendCellSupply, and the chunks asked for any, whose
+    // ChunkTile::demand holds the total
+    std::vector<float> supplyDemand;
+    std::vector<int> demandChunks;
+
+    // Running totals of each team, kept current as cells are added and removed and chunks change owner, so stats
+    // never rescan the cells
+    struct TeamTotals
+    {
+        int cellCount = 0;
+        double attack = 0;
+        double defense = 0;
+        double speed = 0;
+        double metabolism = 0;
+        int ownedChunks = 0;
+    };
+
+    std::vector<TeamTotals> teamTotals;
+
+    // Buffers of chunk cell lists that emptied, handed to lists that gain a cell so that cells crossing into new
+    // chunks don't allocate. Lists that outgrow their buffer reserve at least cellListReserve, the largest list
+    // size seen during the previous step.
+    std::vector<std::vector<CellHandle>> spareCellLists;
+    size_t cellListReserve = 4;
+    size_t peakCellListSize = 0;
+
+    // Chunks updateTerritories visits, by getChunkIndex. A chunk joins when a cell enters it and leaves once it
+    // is empty or wholly owned by the only team in it, so stable territory costs nothing.
+    std::vector<int> activeChunks;
+
+    std::array<uint64_t, NUM_STEP_PHASES> phaseTimes = {};
+
+    // The phases of step and the resources each reads and writes, built by buildStepGraph
+    StepGraph stepGraph;
+
+
+    World(WorldSettings settings, int seed, ctpl::thread_pool* sharedPool);
+
+    // Aborts unless every team's spawn circle lies inside the world.
+    void checkSpawns() const;
+
+    // Claims the teams' spawns, spawns their first cells and draws the supply generation of every chunk from seed.
+    // The chunks and cell store must be empty.
+    void generate();
+
+    // Returns every chunk to its untouched state, setting the tiles aside for reuse, and marks the overlay stale.
+    void clearChunks();
+
+    // Adds the phases of step to stepGraph.
+    void buildStepGraph();
+
+    // Runs one node of stepGraph, timing it towards its phase if timePhases is set.
+    void runStepNode(int node, float delta);
+
+    // Runs the nodes of stepGraph, which must be ready, then every node they ready in turn. Nodes ready at the same
+    // time run at once on the pool.
+    void runStepNodes(const int* nodes, size_t count, float delta);
+
+    // Runs one node of stepGraph and aborts if it changed a resource it doesn't declare writing. Reads aren't checked.
+    void checkStepNode(int node, float delta);
+
+    // Hash of the state making up the resource at bit resource of a StepResource mask, independent of which chunk
+    // tiles are allocated.
+    uint64_t hashStepResource(int resource) const;
 
-    ctpl::thread_pool pool;
+    void updateTerritories(float delta);
 
-    // Searches could probably be improved with an octree
-    std::unique_ptr<sf::Image> territoryMap = std::make_unique<sf::Image>();
+    // Adds the chunk at pos to the set updateTerritories visits.
+    void activateChunk(sf::Vector2i pos);
 
-    std::vector<sf::Vector2i> walkOrder;
+    // Queues the overlay color of the chunk at pos to be recomputed when its tile is next drawn.
+    void markTerritoryDirty(sf::Vector2i pos);
 
+    OverlayTile& getOverlayTile(sf::Vector2i pos) const;
 
-    void updateTerritories(float delta);
+    void setOverlayPixel(sf::Vector2i pos, sf::Color color) const;
 
-    void updateTerritoryColor(sf::Vector2i pos, const std::unique_ptr<Chunk>& chunk);
+    // Brings the overlay tile at tilePos up to date, creating its pixels if it has none.
+    void updateOverlayTile(sf::Vector2i tilePos) const;
+
+    void updateTerritoryColor(sf::Vector2i pos) const;
+
+    // Adds the cells overlapping area, given in world units, to frame.
+    void captureCells(WorldFrame& frame, sf::FloatRect area) const;
 
     void developChunks(float delta);
 
     void updateChunkSupply(float delta);
 
-    void updateCellSupply(float delta);
+    // First half of the UPDATE_CELL_SUPPLY phase: cells pay their upkeep, starve, and ask their chunk for supply.
+    // Touches no chunk supply, so it can run alongside developChunks and updateChunkSupply.
+    void spendCellSupply(float delta);
+
+    // Second half of the UPDATE_CELL_SUPPLY phase: each chunk shares its supply between the cells that asked for it.
+    void shareChunkSupply(float delta);
+
+    // Sums the pull of the chunks around centerPos on teamId's cells.
+    Steering computeSteering(sf::Vector2i centerPos, int teamId) const;
 
     void updateVelocities(float delta);
 
@@ -45,41 +226,150 @@ class World : public sf::Drawable
 
     void attackNearby(float delta);
 
-    void deleteDeadCells();
+    // Takes a cell that just died out of its chunk and its team's totals, and queues it for removeKilledCells.
+    // Phases skip cells with health <= 0 for the rest of the step.
+    void killCell(uint32_t index);
+
+    // Removes the cells killed this step from the store in one compaction pass.
+    void removeKilledCells();
 
     void spawnChildren(float delta);
 
-    void deleteCell(const std::list<std::shared_ptr<Cell>>::iterator& it);
+    // Adds a cell to the store and to the chunk containing its position.
+    void addCell(const Cell& cell);
+
+    // Adds (sign 1) or removes (sign -1) the cell at index from its team's totals.
+    void updateTeamTotals(uint32_t index, int sign);
+
+    // Appends the cell at index to its team's list in the chunk at pos, recording its slot.
+    void insertIntoChunk(uint32_t index, sf::Vector2i pos);
+
+    // Removes the cell at index from its team's list in the chunk at pos, moving the last cell of the list into its
+    // slot.
+    void removeFromChunk(uint32_t index, sf::Vector2i pos);
+
+    // Moves the cell at index from the chunk at from to the chunk at to.
+    void moveCellChunk(uint32_t index, sf::Vector2i from, sf::Vector2i to);
 
-    // Updates cell position. Will also update chunks the cell is in, or moves to.
-    void updateCellPosition(const std::shared_ptr<Cell>& cell, sf::Vector2f newPosition);
+    // Aborts if any cell is not listed at its slot in the chunk containing it, or the chunks list other cells.
+    // step runs this after every step in builds without NDEBUG.
+    void checkChunkMembership() const;
+
+    // Number of contiguous ranges parallelFor splits count items into.
+    size_t taskCount(size_t count);
+
+    // Calls f(task, begin, end) for taskCount(count) contiguous ranges covering [0, count), spread over the pool
+    // and the calling thread. Returns once every range is done.
+    template<class F>
+    void parallelFor(size_t count, F f);
 
     void floodClaim(sf::Vector2i center, int maxIters, int teamId);
 
-    std::shared_ptr<Cell> findNearestEnemies(const Cell& cell, float maxDistance);
+    // Sets a team's ownership of the chunk at index, updating the owner and masks of it and its neighbors if the
+    // value reached or left 0 or 1.
+    void setOwnership(int index, int teamId, float ownership);
+
+    // Recomputes chunkClaimable and chunkEdge of the chunk at pos.
+    void updateChunkMasks(sf::Vector2i pos);
+
+    // Returns the index of the closest enemy of the cell at index, or -1 if none is within maxDistance.
+    // Uses spatialIndex, so it only sees positions as of its last rebuild. maxDistance must not exceed cellAttackRange.
+    int findNearestEnemies(uint32_t index, float maxDistance);
 
-    std::shared_ptr<Cell> findNearestFriendly(const Cell& cell, float maxDistance);
+    // Returns the index of the closest teammate of the cell at index, or -1 if none is within maxDistance.
+    // Same restrictions as findNearestEnemies.
+    int findNearestFriendly(uint32_t index, float maxDistance);
 
-    const std::unique_ptr<Chunk>& getChunk(sf::Vector2i pos) const;
+    // Tile holding the chunk at index, or emptyTile if it was never allocated. Never write through it.
+    const ChunkTile& getTile(int index) const
+    {
+        auto& tile = tiles[index / CHUNK_TILE_AREA];
+        return tile ? *tile : *emptyTile;
+    }
 
-    bool isEdge(sf::Vector2i chunkPos, int teamId);
+    // Tile holding the chunk at index, allocated first if it wasn't.
+    ChunkTile& allocateTile(int index);
 
-    bool isClaimable(sf::Vector2i chunkPos, int teamId);
+    // Cells of teamId in the chunk at index.
+    const std::vector<CellHandle>& getCellList(int index, int teamId) const;
+
+    // Index of the chunk at pos: the index of its tile * CHUNK_TILE_AREA plus its place in the tile.
+    int getChunkIndex(sf::Vector2i pos) const;
+
+    sf::Vector2i getChunkPos(int index) const;
+
+    // True if the chunk borders both chunks teamId fully owns and chunks it doesn't.
+    bool isEdge(sf::Vector2i chunkPos, int teamId) const;
+
+    // True if the chunk borders a chunk teamId fully owns.
+    bool isClaimable(sf::Vector2i chunkPos, int teamId) const;
 
 public:
     ViewMode viewMode = ViewMode::DEFAULT;
 
+    // Accumulate the wall time spent in each phase of step. Off by default.
+    bool timePhases = false;
+
+    // Run the phases of step one at a time, hashing the world around each and aborting if one changed anything it
+    // doesn't declare writing. Undeclared reads go unnoticed. Slow, off by default.
+    bool checkPhaseAccess = false;
+
+    // Aborts if a team has no spawn, or its spawn circle reaches outside the world.
     World(WorldSettings settings, int seed);
 
+    // Builds a world that steps on sharedPool instead of a pool of its own, ignoring settings' numThreads. Steps may
+    // run on a thread of sharedPool, whose idle threads then take over parts of them. sharedPool must outlive the
+    // world.
+    World(WorldSettings settings, int seed, ctpl::thread_pool& sharedPool);
+
     ~World() override;
 
     void step(float delta);
 
+    // Draws the part of the world in the target's view. World units map to target coordinates through states'
+    // transform, so the view decides which chunks are drawn and the cost doesn't grow with the world.
     void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
 
+    // Fills frame with what drawing area, given in world units, needs, in the current viewMode. Reuses frame's
+    // buffers, and only copies the overlay tiles that changed since they were last captured into it. Must not run
+    // while the world steps, but the frame can then be drawn anywhere while it does.
+    void captureFrame(WorldFrame& frame, sf::FloatRect area) const;
+
     sf::Vector2i worldToChunkPos(sf::Vector2f position) const;
 
-    std::string getStats();
+    // Nanoseconds spent in each phase since the last reset, indexed by StepPhase. Only counts while timePhases is set.
+    // Phases that run at once each count the whole time, so the sum can exceed the time spent stepping.
+    const std::array<uint64_t, NUM_STEP_PHASES>& getPhaseTimes() const;
+
+    void resetPhaseTimes();
+
+    size_t getCellCount() const;
+
+    std::vector<TeamStats> getTeamStats() const;
+
+    // Total supply held by the cells of each team. Unlike getTeamStats this walks every cell.
+    std::vector<float> getTeamSupply() const;
+
+    float getWorldTime() const;
+
+    // Writes the simulation state to path in the format described in snapshot.h. Returns false if it could not be
+    // written.
+    bool saveSnapshot(const std::string& path) const;
+
+    // Replaces the simulation state with the snapshot at path, which must come from a world with the same chunk grid
+    // and number of teams. Returns false, leaving the world as it was, if the file can't be read or doesn't match.
+    bool loadSnapshot(const std::string& path);
+
+    // Replaces the seed the world's random streams derive from, so that worlds loaded from one snapshot can diverge.
+    void reseed(int seed);
+
+    // Starts the world over as if it had just been constructed with seed, keeping its buffers and threads so that
+    // running many worlds in turn doesn't allocate them again.
+    void reset(int seed);
+
+    // Hash of the simulation state: every cell, chunk ownership and supply, and the world time. Worlds with the same
+    // seed and settings stepped with the same deltas hash the same, whatever their thread counts.
+    uint64_t stateHash() const;
 };
 
 #endif //CELL_BATTLES_WORLD_H
@@ -0,0 +1,65 @@
+#ifndef CELL_BATTLES_WORLD_FRAME_H
+#define CELL_BATTLES_WORLD_FRAME_H
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "team_stats.h"
+
+// Chunks along each side of an overlay tile
+#define OVERLAY_TILE_CHUNKS 256
+
+// What drawing a world needs at one moment: its cells and chunk overlay around an area, and its stats. Filled by
+// World::captureFrame and drawn by FrameRenderer, which never touches the world, so a frame can be drawn on one
+// thread while the world steps on another.
+struct WorldFrame
+{
+    // Overlay colors of one square of OVERLAY_TILE_CHUNKS x OVERLAY_TILE_CHUNKS chunks, or fewer at the far edges
+    struct OverlayTile
+    {
+        sf::Vector2i size;
+        // One RGBA pixel per chunk, in row-major order
+        std::vector<sf::Uint8> pixels;
+        // Version of the world's tile the pixels were copied from, 0 if they never were
+        uint64_t version = 0;
+    };
+
+    // Size of the world in world units, and of its chunks
+    sf::Vector2f size;
+    sf::Vector2i numChunks;
+    float pixelsPerChunk = 1;
+    float cellRadius = 0;
+
+    // Area captured, in world units. Cells and overlay tiles outside it were left out.
+    sf::FloatRect area;
+
+    // Cells overlapping area
+    std::vector<sf::Vector2f> cellPositions;
+    std::vector<sf::Color> cellColors;
+
+    // Every overlay tile of the world in row-major order. Only those in [firstTile, lastTile] are current, the
+    // others hold whatever an earlier capture into this frame left.
+    sf::Vector2i numOverlayTiles;
+    std::vector<OverlayTile> overlayTiles;
+    sf::Vector2i firstTile;
+    sf::Vector2i lastTile = {-1, -1};
+
+    float worldTime = 0;
+    std::vector<TeamStats> teamStats;
+};
+
+// Chunk containing position, given in world units, clamped to a grid of numChunks chunks pixelsPerChunk units wide.
+inline sf::Vector2i getClampedChunkPos(sf::Vector2f position, float pixelsPerChunk, sf::Vector2i numChunks)
+{
+    return {std::min(std::max((int) (position.x / pixelsPerChunk), 0), numChunks.x - 1),
+            std::min(std::max((int) (position.y / pixelsPerChunk), 0), numChunks.y - 1)};
+}
+
+// Area holding the positions of every cell drawn over area: cells reach up to their radius past their position.
+inline sf::FloatRect getCellCullArea(sf::FloatRect area, float cellRadius)
+{
+    return {area.left - cellRadius, area.top - cellRadius, area.width + 2 * cellRadius, area.height + 2 * cellRadius};
+}
+
+#endif //CELL_BATTLES_WORLD_FRAME_H
@@ -7,15 +7,18 @@
 struct WorldSettings
 {
     friend class World;
+    friend class ReplayRecorder;
 
 private:
     sf::Vector2i numChunks;
 
 public:
-    // Screen aspect ratio (width / height)
+    // Size of the world in world units. It has nothing to do with the window the world is drawn in, which shows
+    // whatever part of it the view covers.
     int width;
     int height;
 
+    // Side of a chunk in world units
     float pixelsPerChunk;
 
     // Radius of cells when rendered.
@@ -24,7 +27,7 @@ public:
     // Maximum distance for cells to attack.
     float cellAttackRange;
 
-    // Number of cell teams
+    // Number of cell teams, at most 64
     int numTeams;
 
     // Number of cells to spawn per team at start
@@ -33,7 +36,7 @@ public:
     // Color of each team
     std::vector<sf::Color> teamColors;
 
-    // Center of the spawn circle
+    // Center of the spawn circle of each team. Spawn circles must lie inside the world.
     std::vector<sf::Vector2f> teamSpawns;
 
     // Radius of the spawn circle
@@ -44,6 +47,12 @@ public:
     float childSpawnDelay = 20.f;
 
     float speed = 1.f;
+
+    // Threads used to step the world, counting the thread calling step(). 0 uses every hardware thread.
+    int numThreads = 0;
+
+    // The standard four-team game on a width x height world, with teams spawning near the corners.
+    static WorldSettings standard(int width, int height);
 };
 
 #endif //CELL_BATTLES_WORLD_SETTINGS_H
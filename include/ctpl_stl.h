@@ -14,6 +14,9 @@
 *  See the License for the specific language governing permissions and
 *  limitations under the License.
 *
+*  Modified: the mutex guarded queue is replaced by per thread
+*  work stealing deques, and parallel_for is added.
+*
 *********************************************************/
 
 
@@ -28,43 +31,173 @@
 #include <exception>
 #include <future>
 #include <mutex>
-#include <queue>
+#include <condition_variable>
+#include <deque>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 
 
 // thread pool to run user's functors with signature
 //      ret func(int id, other_params)
-// where id is the index of the thread that runs the functor
+// where id is the index of the thread that runs the functor, or size() for a thread outside the pool that is
+// running tasks while it waits in parallel_for
 // ret is some return type
+//
+// every thread owns a Chase-Lev deque of tasks. Threads push and pop at the bottom of their own deque and steal from
+// the top of the others' once theirs is empty. Functors pushed from outside the pool go to a shared queue instead.
+// Idle threads spin briefly before parking, so back to back parallel_for calls don't pay for waking them up.
 
 
 namespace ctpl {
 
+    class thread_pool;
+
     namespace detail {
-        template <typename T>
-        class Queue {
+
+        inline void cpu_relax() {
+#if defined(__SSE2__) || defined(_M_X64)
+            _mm_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+        // a type erased void(int id) functor, stored inline when it fits so forking a task does not allocate
+        class Task {
         public:
-            bool push(T const & value) {
-                std::unique_lock<std::mutex> lock(this->mutex);
-                this->q.push(value);
-                return true;
+            static constexpr std::size_t inline_size = 64;
+
+            Task() = default;
+            Task(const Task &) = delete;
+            Task & operator=(const Task &) = delete;
+            ~Task() { if (this->destroy) this->destroy(this->storage); }
+
+            template<typename F>
+            void set(F && f) {
+                using Fn = typename std::decay<F>::type;
+                if constexpr (sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t)) {
+                    new (this->storage) Fn(std::forward<F>(f));
+                    this->invoke = [](void * s, int id) { (*static_cast<Fn *>(s))(id); };
+                    this->destroy = [](void * s) { static_cast<Fn *>(s)->~Fn(); };
+                }
+                else {
+                    *reinterpret_cast<Fn **>(this->storage) = new Fn(std::forward<F>(f));
+                    this->invoke = [](void * s, int id) { (**static_cast<Fn **>(s))(id); };
+                    this->destroy = [](void * s) { delete *static_cast<Fn **>(s); };
+                }
             }
-            // deletes the retrieved element, do not use for non integral types
-            bool pop(T & v) {
-                std::unique_lock<std::mutex> lock(this->mutex);
-                if (this->q.empty())
-                    return false;
-                v = this->q.front();
-                this->q.pop();
-                return true;
+
+            void operator()(int id) { this->invoke(this->storage, id); }
+
+            // heap allocated by push and deleted once run; forked tasks live on the forking thread's stack and set
+            // done instead
+            bool owned = false;
+            std::atomic<bool> done{false};
+
+        private:
+            alignas(std::max_align_t) unsigned char storage[inline_size];
+            void (*invoke)(void *, int) = nullptr;
+            void (*destroy)(void *) = nullptr;
+        };
+
+        // Chase-Lev work stealing deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models"),
+        // with the fences folded into sequentially consistent accesses of top and bottom. pushing also orders the new
+        // task before anything the pusher does next, such as checking for parked threads to wake.
+        // only the owner calls push and pop; any thread may steal
+        class Deque {
+        public:
+            Deque() : array(new Array(256)) {}
+            Deque(const Deque &) = delete;
+            Deque & operator=(const Deque &) = delete;
+            ~Deque() { delete this->array.load(std::memory_order_relaxed); }
+
+            void push(Task * task) {
+                std::int64_t b = this->bottom.load(std::memory_order_relaxed);
+                std::int64_t t = this->top.load(std::memory_order_acquire);
+                Array * a = this->array.load(std::memory_order_relaxed);
+                if (b - t > a->capacity - 1)
+                    a = this->grow(a, t, b);
+                a->put(b, task);
+                this->bottom.store(b + 1, std::memory_order_seq_cst);
             }
-            bool empty() {
-                std::unique_lock<std::mutex> lock(this->mutex);
-                return this->q.empty();
+
+            Task * pop() {
+                std::int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+                Array * a = this->array.load(std::memory_order_relaxed);
+                this->bottom.store(b, std::memory_order_seq_cst);
+                std::int64_t t = this->top.load(std::memory_order_seq_cst);
+                if (t > b) {  // empty
+                    this->bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                Task * task = a->get(b);
+                if (t == b) {  // the last task, thieves may be racing for it
+                    if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed))
+                        task = nullptr;
+                    this->bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return task;
+            }
+
+            // returns nullptr if the deque is empty or another thread took the task first
+            Task * steal() {
+                std::int64_t t = this->top.load(std::memory_order_seq_cst);
+                std::int64_t b = this->bottom.load(std::memory_order_seq_cst);
+                if (t >= b)
+                    return nullptr;
+                Array * a = this->array.load(std::memory_order_acquire);
+                Task * task = a->get(t);
+                if (!this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return nullptr;
+                return task;
+            }
+
+            bool empty() const {
+                return this->bottom.load(std::memory_order_seq_cst) <= this->top.load(std::memory_order_seq_cst);
             }
+
         private:
-            std::queue<T> q;
-            std::mutex mutex;
+            struct Array {
+                explicit Array(std::int64_t capacity) : capacity(capacity), items(new std::atomic<Task *>[capacity]) {}
+                Task * get(std::int64_t i) const { return this->items[i & (this->capacity - 1)].load(std::memory_order_relaxed); }
+                void put(std::int64_t i, Task * task) { this->items[i & (this->capacity - 1)].store(task, std::memory_order_relaxed); }
+
+                std::int64_t capacity;
+                std::unique_ptr<std::atomic<Task *>[]> items;
+            };
+
+            Array * grow(Array * a, std::int64_t t, std::int64_t b) {
+                Array * bigger = new Array(a->capacity * 2);
+                for (std::int64_t i = t; i < b; ++i)
+                    bigger->put(i, a->get(i));
+                // thieves may still be reading the old array, so it is kept until the deque goes
+                this->retired.emplace_back(a);
+                this->array.store(bigger, std::memory_order_release);
+                return bigger;
+            }
+
+            alignas(64) std::atomic<std::int64_t> top{0};
+            alignas(64) std::atomic<std::int64_t> bottom{0};
+            std::atomic<Array *> array;
+            std::vector<std::unique_ptr<Array>> retired;
+        };
+
+        struct Worker {
+            Worker(thread_pool * pool, int id) : pool(pool), id(id) {}
+
+            thread_pool * pool;
+            int id;
+            Deque deque;
+            // where the next steal starts, so thieves spread over their victims
+            std::size_t victim = 0;
         };
     }
 
@@ -89,50 +222,52 @@ namespace ctpl {
 
         // change the number of threads in the pool
         // should be called from one thread, otherwise be careful to not interleave, also with this->stop()
+        // threads can't leave while others may steal from them, so this waits for the queued functions to finish
+        // and restarts the pool; it must not be called while parallel_for is running
         // nThreads must be >= 0
         void resize(int nThreads) {
-            if (!this->isStop && !this->isDone) {
-                int oldNThreads = static_cast<int>(this->threads.size());
-                if (oldNThreads <= nThreads) {  // if the number of threads is increased
-                    this->threads.resize(nThreads);
-                    this->flags.resize(nThreads);
-
-                    for (int i = oldNThreads; i < nThreads; ++i) {
-                        this->flags[i] = std::make_shared<std::atomic<bool>>(false);
-                        this->set_thread(i);
-                    }
-                }
-                else {  // the number of threads is decreased
-                    for (int i = oldNThreads - 1; i >= nThreads; --i) {
-                        *this->flags[i] = true;  // this thread will finish
-                        this->threads[i]->detach();
-                    }
-                    {
-                        // stop the detached threads that were waiting
-                        std::unique_lock<std::mutex> lock(this->mutex);
-                        this->cv.notify_all();
-                    }
-                    this->threads.resize(nThreads);  // safe to delete because the threads are detached
-                    this->flags.resize(nThreads);  // safe to delete because the threads have copies of shared_ptr of the flags, not originals
-                }
-            }
+            if (this->isStop || this->isDone || nThreads == this->size())
+                return;
+
+            this->isDone = true;
+            this->wake_all();
+            for (auto & thread : this->threads)
+                thread->join();
+            this->threads.clear();
+            this->isDone = false;
+
+            this->workers.clear();
+            for (int i = 0; i <= nThreads; ++i)
+                this->workers.emplace_back(new detail::Worker(this, i));
+            for (int i = 0; i < nThreads; ++i)
+                this->threads.emplace_back(new std::thread([this, i]() { this->run_worker(i); }));
         }
 
         // empty the queue
         void clear_queue() {
-            std::function<void(int id)> * _f;
-            while (this->q.pop(_f))
-                delete _f; // empty the queue
+            std::unique_lock<std::mutex> lock(this->mutex);
+            for (detail::Task * task : this->q)
+                delete task;
+            this->q.clear();
+            this->nQueued = 0;
         }
 
         // pops a functional wrapper to the original function
         std::function<void(int)> pop() {
-            std::function<void(int id)> * _f = nullptr;
-            this->q.pop(_f);
-            std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
+            detail::Task * task = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (!this->q.empty()) {
+                    task = this->q.front();
+                    this->q.pop_front();
+                    --this->nQueued;
+                }
+            }
             std::function<void(int)> f;
-            if (_f)
-                f = *_f;
+            if (task) {
+                std::shared_ptr<detail::Task> func(task);
+                f = [func](int id) { (*func)(id); };
+            }
             return f;
         }
 
@@ -144,9 +279,6 @@ namespace ctpl {
                 if (this->isStop)
                     return;
                 this->isStop = true;
-                for (int i = 0, n = this->size(); i < n; ++i) {
-                    *this->flags[i] = true;  // command the threads to stop
-                }
                 this->clear_queue();  // empty the queue
             }
             else {
@@ -154,96 +286,285 @@ namespace ctpl {
                     return;
                 this->isDone = true;  // give the waiting threads a command to finish
             }
-            {
-                std::unique_lock<std::mutex> lock(this->mutex);
-                this->cv.notify_all();  // stop all waiting threads
-            }
+            this->wake_all();
             for (int i = 0; i < static_cast<int>(this->threads.size()); ++i) {  // wait for the computing threads to finish
                     if (this->threads[i]->joinable())
                         this->threads[i]->join();
             }
             // if there were no threads in the pool but some functors in the queue, the functors are not deleted by the threads
-            // therefore delete them here
+            // therefore delete them here, and those pushed by functors that were dropped by stop() too
             this->clear_queue();
+            for (auto & worker : this->workers) {
+                while (detail::Task * task = worker->deque.pop())
+                    if (task->owned)
+                        delete task;
+            }
             this->threads.clear();
-            this->flags.clear();
         }
 
         template<typename F, typename... Rest>
         auto push(F && f, Rest&&... rest) ->std::future<decltype(f(0, rest...))> {
-            auto pck = std::make_shared<std::packaged_task<decltype(f(0, rest...))(int)>>(
-                std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...)
-                );
-            auto _f = new std::function<void(int id)>([pck](int id) {
-                (*pck)(id);
-            });
-            this->q.push(_f);
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cv.notify_one();
-            return pck->get_future();
+            return this->push(std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...));
         }
 
         // run the user's function that excepts argument int - id of the running thread. returned value is templatized
         // operator returns std::future, where the user can get the result and rethrow the catched exceptins
+        // the future's shared state is allocated; parallel_for doesn't allocate
         template<typename F>
         auto push(F && f) ->std::future<decltype(f(0))> {
-            auto pck = std::make_shared<std::packaged_task<decltype(f(0))(int)>>(std::forward<F>(f));
-            auto _f = new std::function<void(int id)>([pck](int id) {
-                (*pck)(id);
-            });
-            this->q.push(_f);
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cv.notify_one();
-            return pck->get_future();
+            std::packaged_task<decltype(f(0))(int)> pck(std::forward<F>(f));
+            auto future = pck.get_future();
+            auto task = new detail::Task;
+            task->owned = true;
+            task->set([pck = std::move(pck)](int id) mutable { pck(id); });
+
+            // functors pushed by a thread of the pool stay on its deque
+            detail::Worker * self = current();
+            if (self != nullptr && self->pool == this) {
+                self->deque.push(task);
+                this->wake_one();
+            }
+            else {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->q.push_back(task);
+                ++this->nQueued;
+                this->cv.notify_one();
+            }
+            return future;
+        }
+
+        // calls f(task, begin, end) for every task in [0, numTasks), with [0, count) split evenly between the tasks
+        // in order, and returns once all have returned. tasks are forked by halving the task range, so idle threads
+        // steal the biggest halves first, and the calling thread runs tasks while it waits instead of idling. nothing
+        // is allocated. the first exception thrown by a task is rethrown here after every task has finished
+        template<typename F>
+        void parallel_for(std::size_t count, std::size_t numTasks, F && f) {
+            auto rangeStart = [&](std::size_t task) { return count * task / numTasks; };
+            if (numTasks <= 1 || this->threads.empty()) {
+                for (std::size_t task = 0; task < numTasks; ++task)
+                    f(task, rangeStart(task), rangeStart(task + 1));
+                return;
+            }
+
+            std::exception_ptr error;
+            std::atomic<bool> failed{false};
+            auto run = [&](std::size_t task) {
+                try {
+                    f(task, rangeStart(task), rangeStart(task + 1));
+                }
+                catch (...) {
+                    if (!failed.exchange(true))
+                        error = std::current_exception();
+                }
+            };
+
+            // threads from outside the pool take turns on the spare deque
+            detail::Worker * self = current();
+            if (self != nullptr && self->pool == this) {
+                this->fork(self, 0, numTasks, run);
+            }
+            else {
+                std::unique_lock<std::mutex> lock(this->externalMutex);
+                detail::Worker * outer = self;
+                self = current() = this->workers.back().get();
+                this->fork(self, 0, numTasks, run);
+                current() = outer;
+            }
+
+            if (error)
+                std::rethrow_exception(error);
         }
 
 
     private:
 
+        // tries to find work this many times between short pauses, then yields as many times, then parks
+        static constexpr int spinRounds = 64;
+        static constexpr int yieldRounds = 32;
+
         // deleted
         thread_pool(const thread_pool &);// = delete;
         thread_pool(thread_pool &&);// = delete;
         thread_pool & operator=(const thread_pool &);// = delete;
         thread_pool & operator=(thread_pool &&);// = delete;
 
-        void set_thread(int i) {
-            std::shared_ptr<std::atomic<bool>> flag(this->flags[i]); // a copy of the shared ptr to the flag
-            auto f = [this, i, flag/* a copy of the shared ptr to the flag */]() {
-                std::atomic<bool> & _flag = *flag;
-                std::function<void(int id)> * _f;
-                bool isPop = this->q.pop(_f);
-                while (true) {
-                    while (isPop) {  // if there is anything in the queue
-                        std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
-                        (*_f)(i);
-                        if (_flag)
-                            return;  // the thread is wanted to stop, return even if the queue is not empty yet
-                        else
-                            isPop = this->q.pop(_f);
-                    }
-                    // the queue is empty here, wait for the next command
-                    std::unique_lock<std::mutex> lock(this->mutex);
-                    ++this->nWaiting;
-                    this->cv.wait(lock, [this, &_f, &isPop, &_flag](){ isPop = this->q.pop(_f); return isPop || this->isDone || _flag; });
-                    --this->nWaiting;
-                    if (!isPop)
-                        return;  // if the queue is empty and this->isDone == true or *flag then return
+        // the worker the calling thread is running as, if any
+        static detail::Worker *& current() {
+            static thread_local detail::Worker * worker = nullptr;
+            return worker;
+        }
+
+        void run_worker(int i) {
+            detail::Worker * self = this->workers[i].get();
+            current() = self;
+            while (true) {
+                if (detail::Task * task = this->spin_for_work(self, true)) {
+                    this->execute(task, self);
+                    continue;
                 }
-            };
-            this->threads[i].reset(new std::thread(f)); // compiler may not support std::make_unique()
+                if (this->isStop || this->isDone)
+                    return;  // nothing left to run
+
+                std::unique_lock<std::mutex> lock(this->mutex);
+                ++this->nWaiting;
+                while (!this->has_work() && !this->isDone && !this->isStop)
+                    this->cv.wait(lock);
+                --this->nWaiting;
+            }
+        }
+
+        template<typename G>
+        void fork(detail::Worker * self, std::size_t begin, std::size_t end, G & run) {
+            if (end - begin == 1) {
+                run(begin);
+                return;
+            }
+
+            std::size_t mid = begin + (end - begin) / 2;
+            detail::Task right;
+            right.set([this, mid, end, &run](int id) { this->fork(this->workers[id].get(), mid, end, run); });
+            self->deque.push(&right);
+            this->wake_one();
+
+            this->fork(self, begin, mid, run);
+            this->join(right, self);
         }
 
-        void init() { this->nWaiting = 0; this->isStop = false; this->isDone = false; }
+        // waits for a forked task: runs it if nobody stole it, otherwise helps with other tasks, spins and parks
+        void join(detail::Task & task, detail::Worker * self) {
+            // tasks pushed after it come off the deque first
+            while (!task.done.load(std::memory_order_acquire)) {
+                detail::Task * popped = self->deque.pop();
+                if (popped == nullptr)
+                    break;
+                this->execute(popped, self);
+            }
+
+            while (!task.done.load(std::memory_order_acquire)) {
+                if (detail::Task * other = this->spin_for_work(self, false, &task.done)) {
+                    this->execute(other, self);
+                    continue;
+                }
+                if (task.done.load(std::memory_order_acquire))
+                    break;
+
+                std::unique_lock<std::mutex> lock(this->joinMutex);
+                ++this->nJoining;
+                while (!task.done.load(std::memory_order_seq_cst))
+                    this->joinCv.wait(lock);
+                --this->nJoining;
+            }
+        }
+
+        void execute(detail::Task * task, detail::Worker * self) {
+            (*task)(self->id);
+            if (task->owned) {
+                delete task;
+                return;
+            }
+
+            // the forking thread may return as soon as done is set, so the task is not touched after
+            task->done.store(true, std::memory_order_seq_cst);
+            if (this->nJoining.load(std::memory_order_seq_cst) > 0) {
+                std::unique_lock<std::mutex> lock(this->joinMutex);
+                this->joinCv.notify_all();
+            }
+        }
+
+        // looks for work, then keeps looking for a while. gives up early once stopFlag is set
+        detail::Task * spin_for_work(detail::Worker * self, bool takeQueued,
+                                     const std::atomic<bool> * stopFlag = nullptr) {
+            for (int round = 0; round < spinRounds + yieldRounds; ++round) {
+                if (detail::Task * task = this->find_work(self, takeQueued))
+                    return task;
+                if (stopFlag != nullptr && stopFlag->load(std::memory_order_acquire))
+                    return nullptr;
+                if (takeQueued && (this->isStop || this->isDone))
+                    return nullptr;
+
+                if (round < spinRounds) {
+                    for (int i = 0; i < 8; ++i)
+                        detail::cpu_relax();
+                }
+                else {
+                    std::this_thread::yield();
+                }
+            }
+            return nullptr;
+        }
+
+        detail::Task * find_work(detail::Worker * self, bool takeQueued) {
+            if (detail::Task * task = self->deque.pop())
+                return task;
+
+            std::size_t n = this->workers.size();
+            for (std::size_t k = 0; k < n; ++k) {
+                self->victim = self->victim + 1 < n ? self->victim + 1 : 0;
+                if (self->victim == static_cast<std::size_t>(self->id))
+                    continue;
+                if (detail::Task * task = this->workers[self->victim]->deque.steal())
+                    return task;
+            }
+
+            if (takeQueued && this->nQueued.load(std::memory_order_acquire) > 0) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                if (!this->q.empty()) {
+                    detail::Task * task = this->q.front();
+                    this->q.pop_front();
+                    --this->nQueued;
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+
+        bool has_work() {
+            if (this->nQueued.load(std::memory_order_seq_cst) > 0)
+                return true;
+            for (auto & worker : this->workers)
+                if (!worker->deque.empty())
+                    return true;
+            return false;
+        }
+
+        // parking threads count themselves before checking for work, and pushes publish work before checking the
+        // count, so either the pusher sees the thread or the thread sees the work
+        void wake_one() {
+            if (this->nWaiting.load(std::memory_order_seq_cst) > 0) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.notify_one();
+            }
+        }
+
+        void wake_all() {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.notify_all();
+        }
+
+        void init() {
+            this->nWaiting = 0; this->nJoining = 0; this->nQueued = 0; this->isStop = false; this->isDone = false;
+            this->workers.emplace_back(new detail::Worker(this, 0));
+        }
 
         std::vector<std::unique_ptr<std::thread>> threads;
-        std::vector<std::shared_ptr<std::atomic<bool>>> flags;
-        detail::Queue<std::function<void(int id)> *> q;
+        // one per thread, then a spare one for threads outside the pool running parallel_for
+        std::vector<std::unique_ptr<detail::Worker>> workers;
+        std::mutex externalMutex;
+
+        // functors pushed from outside the pool
+        std::deque<detail::Task *> q;
+        std::atomic<int> nQueued;
         std::atomic<bool> isDone;
         std::atomic<bool> isStop;
         std::atomic<int> nWaiting;  // how many threads are waiting
 
         std::mutex mutex;
         std::condition_variable cv;
+
+        // threads waiting in join for a stolen task
+        std::atomic<int> nJoining;
+        std::mutex joinMutex;
+        std::condition_variable joinCv;
     };
 
 }
@@ -0,0 +1,215 @@
+#include "world/world.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// Steps fixed seeds at several world scales and prints one JSON object per scale, with steps per second,
+// nanoseconds per cell spent in each step phase and the peak resident set size of the process.
+//
+// Heap allocations are counted by replacing the global operator new. With --assert-no-allocations the bench fails
+// if any measured step allocated.
+//
+// Usage: cell-battles-bench [--scale NAME] [--seed N] [--steps N] [--warmup N] [--threads N]
+//                           [--assert-no-allocations]
+
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+struct BenchScale
+{
+    const char* name;
+    int width;
+    int height;
+    float pixelsPerChunk;
+    int numTeams;
+    int initialCellsPerTeam;
+};
+
+static const BenchScale SCALES[] = {
+        {"small",      1920, 1080, 10, 4,  10},
+        {"dense",      1920, 1080, 10, 4,  2000},
+        {"coarse",     1920, 1080, 40, 4,  2000},
+        {"many-teams", 1920, 1080, 10, 16, 500},
+        {"large",      7680, 4320, 10, 8,  5000},
+};
+
+static WorldSettings makeSettings(const BenchScale& scale)
+{
+    WorldSettings settings = WorldSettings::standard(scale.width, scale.height);
+    settings.pixelsPerChunk = scale.pixelsPerChunk;
+    settings.numTeams = scale.numTeams;
+    settings.initialCellsPerTeam = scale.initialCellsPerTeam;
+    settings.spawnRadius = 5.f + sqrtf((float) scale.initialCellsPerTeam);
+
+    // Spread spawns evenly around an ellipse inset from the world edges
+    const sf::Color palette[] = {sf::Color::Green, sf::Color::Red, sf::Color::Yellow, sf::Color::Blue,
+                                 sf::Color::Magenta, sf::Color::Cyan, sf::Color::White};
+    settings.teamColors.clear();
+    settings.teamSpawns.clear();
+    for (int i = 0; i < scale.numTeams; i++)
+    {
+        float angle = 6.2831853f * (float) i / (float) scale.numTeams;
+        settings.teamColors.push_back(palette[i % (sizeof(palette) / sizeof(palette[0]))]);
+        settings.teamSpawns.emplace_back((float) scale.width * (0.5f + 0.35f * cosf(angle)),
+                                         (float) scale.height * (0.5f + 0.35f * sinf(angle)));
+    }
+
+    return settings;
+}
+
+// Peak resident set size of this process in kilobytes, or -1 where unsupported.
+static long getPeakRssKb()
+{
+#if defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+#elif defined(__unix__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return -1;
+#endif
+}
+
+// Returns the number of heap allocations made during the measured steps.
+static uint64_t runScale(const BenchScale& scale, int seed, int warmupSteps, int steps, int threads)
+{
+    constexpr float dt = 0.05f;
+
+    WorldSettings settings = makeSettings(scale);
+    settings.numThreads = threads;
+    World world(settings, seed);
+
+    for (int i = 0; i < warmupSteps; i++)
+        world.step(dt);
+
+    world.timePhases = true;
+    world.resetPhaseTimes();
+
+    double cellSteps = 0;
+    uint64_t allocations = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+        cellSteps += (double) world.getCellCount();
+        uint64_t before = allocationCount.load(std::memory_order_relaxed);
+        world.step(dt);
+        allocations += allocationCount.load(std::memory_order_relaxed) - before;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("{\"scale\":\"%s\",\"seed\":%d,\"width\":%d,\"height\":%d,\"pixelsPerChunk\":%g,"
+                "\"numTeams\":%d,\"initialCellsPerTeam\":%d,\"threads\":%d,\"steps\":%d,"
+                "\"stepsPerSecond\":%.3f,\"averageCells\":%.1f,\"finalCells\":%zu,\"nsPerCell\":{",
+                scale.name, seed, scale.width, scale.height, scale.pixelsPerChunk, scale.numTeams,
+                scale.initialCellsPerTeam, threads, steps, steps / elapsed.count(),
+                steps > 0 ? cellSteps / steps : 0.0, world.getCellCount());
+
+    auto& phaseTimes = world.getPhaseTimes();
+    for (int phase = 0; phase < NUM_STEP_PHASES; phase++)
+    {
+        double nsPerCell = cellSteps > 0 ? (double) phaseTimes[phase] / cellSteps : 0.0;
+        std::printf("%s\"%s\":%.3f", phase == 0 ? "" : ",", getStepPhaseName((StepPhase) phase), nsPerCell);
+    }
+
+    std::printf("},\"allocationsPerStep\":%.3f,\"peakRssKb\":%ld}\n",
+                steps > 0 ? (double) allocations / steps : 0.0, getPeakRssKb());
+    std::fflush(stdout);
+
+    return allocations;
+}
+
+static void printUsage(const char* program)
+{
+    std::fprintf(stderr, "Usage: %s [--scale NAME] [--seed N] [--steps N] [--warmup N] [--threads N]\n"
+                         "       [--assert-no-allocations]\n", program);
+}
+
+int main(int argc, char** argv)
+{
+    const char* scaleName = nullptr;
+    int seed = 3211;
+    int steps = 500;
+    int warmupSteps = 500;
+    int threads = 0;
+    bool assertNoAllocations = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--assert-no-allocations") == 0)
+        {
+            assertNoAllocations = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        if (std::strcmp(arg, "--scale") == 0) scaleName = value;
+        else if (std::strcmp(arg, "--seed") == 0) seed = std::atoi(value);
+        else if (std::strcmp(arg, "--steps") == 0) steps = std::atoi(value);
+        else if (std::strcmp(arg, "--warmup") == 0) warmupSteps = std::atoi(value);
+        else if (std::strcmp(arg, "--threads") == 0) threads = std::atoi(value);
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Peak RSS is process wide, so scales run from smallest to largest.
+    bool ran = false;
+    uint64_t allocations = 0;
+    for (auto& scale: SCALES)
+    {
+        if (scaleName != nullptr && std::strcmp(scaleName, scale.name) != 0) continue;
+        allocations += runScale(scale, seed, warmupSteps, steps, threads);
+        ran = true;
+    }
+
+    if (!ran)
+    {
+        std::fprintf(stderr, "Unknown scale '%s'\n", scaleName);
+        return 1;
+    }
+
+    if (assertNoAllocations && allocations > 0)
+    {
+        std::fprintf(stderr, "%llu heap allocations during measured steps\n", (unsigned long long) allocations);
+        return 1;
+    }
+
+    return 0;
+}
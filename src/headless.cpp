@@ -0,0 +1,281 @@
+#include "world/batch_runner.h"
+#include "world/replay_player.h"
+#include "world/replay_recorder.h"
+#include "world/telemetry.h"
+#include "world/trace.h"
+#include "world/world.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+// Runs worlds without a window and prints the final per-team stats of each run as CSV.
+//
+// --load starts every run from a snapshot instead of a new world, reseeded with the run's seed so runs diverge.
+// --save writes the final state of the last run to a snapshot.
+//
+// --record writes every step of the last run to a replay, which the game plays with --replay.
+//
+// --telemetry writes per-team stats and phase timings of every run to a CSV file every --telemetry-interval steps.
+//
+// With --verify every run is stepped alongside a single threaded copy, and their state hashes are compared after
+// each step. The first mismatch is reported and fails the run. With --record too, the replay is then played forward
+// and back, and fails the run unless the cell counts and owned chunks of every frame match the recorded world's.
+//
+// --trace writes the trace markers of every run to a Chrome trace JSON file at the end. It needs a build with
+// CELL_BATTLES_TRACE, and only holds the last few thousand steps of each thread.
+//
+// --check-phases runs the phases of every step one at a time, and fails if one changes state it doesn't declare
+// writing. It can't tell if a phase reads state it doesn't declare.
+//
+// --batch runs all runs at once, one world per thread on --threads threads, instead of one after another with every
+// thread stepping the same world. The output is the same, but it keeps every core busy on small worlds.
+//
+// Usage: cell-battles-headless [--seed N] [--runs N] [--steps N] [--dt SECONDS]
+//                              [--width N] [--height N] [--cells N] [--threads N]
+//                              [--load PATH] [--save PATH] [--record PATH] [--telemetry PATH]
+//                              [--telemetry-interval N] [--trace PATH] [--verify] [--check-phases] [--batch]
+
+// Smallest --width and --height accepted
+#define MIN_WORLD_SIZE 50
+
+// Plays the replay at path forward and then back, comparing the team stats of every frame with the ones recorded.
+// Returns false at the first mismatch.
+static bool verifyReplay(const char* path, const std::vector<std::vector<TeamStats>>& recordedStats)
+{
+    ReplayPlayer player;
+    if (!player.open(path)) return false;
+    if (player.getNumFrames() != recordedStats.size())
+    {
+        std::fprintf(stderr, "replay holds %u frames instead of %zu\n", player.getNumFrames(), recordedStats.size());
+        return false;
+    }
+
+    int64_t numFrames = (int64_t) recordedStats.size();
+    for (int64_t i = 0; i < 2 * numFrames; i++)
+    {
+        int64_t frame = i < numFrames ? i : 2 * numFrames - 1 - i;
+        if (!player.seek(frame)) return false;
+
+        auto stats = player.getTeamStats();
+        auto& recorded = recordedStats[frame];
+        for (size_t team = 0; team < stats.size(); team++)
+        {
+            if (stats[team].cellCount == recorded[team].cellCount &&
+                stats[team].ownedChunks == recorded[team].ownedChunks)
+                continue;
+
+            std::fprintf(stderr, "replay frame %lld, team %zu: %d cells and %d owned chunks instead of %d and %d\n",
+                         (long long) frame, team, stats[team].cellCount, stats[team].ownedChunks,
+                         recorded[team].cellCount, recorded[team].ownedChunks);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void printUsage(const char* program)
+{
+    std::fprintf(stderr, "Usage: %s [--seed N] [--runs N] [--steps N] [--dt SECONDS]\n"
+                         "       [--width N] [--height N] [--cells N] [--threads N]\n"
+                         "       [--load PATH] [--save PATH] [--record PATH] [--telemetry PATH]\n"
+                         "       [--telemetry-interval N] [--trace PATH] [--verify] [--check-phases] [--batch]\n",
+                 program);
+}
+
+int main(int argc, char** argv)
+{
+    int seed = 3211;
+    int runs = 1;
+    int steps = 10000;
+    float dt = 1.f / 60.f;
+    int width = 1920;
+    int height = 1080;
+    int cellsPerTeam = -1;
+    int threads = 0;
+    const char* loadPath = nullptr;
+    const char* savePath = nullptr;
+    const char* recordPath = nullptr;
+    const char* telemetryPath = nullptr;
+    int telemetryInterval = 60;
+    const char* tracePath = nullptr;
+    bool verify = false;
+    bool checkPhases = false;
+    bool batch = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--verify") == 0)
+        {
+            verify = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--check-phases") == 0)
+        {
+            checkPhases = true;
+            continue;
+        }
+        if (std::strcmp(arg, "--batch") == 0)
+        {
+            batch = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+
+        if (std::strcmp(arg, "--seed") == 0) seed = std::atoi(value);
+        else if (std::strcmp(arg, "--runs") == 0) runs = std::atoi(value);
+        else if (std::strcmp(arg, "--steps") == 0) steps = std::atoi(value);
+        else if (std::strcmp(arg, "--dt") == 0) dt = (float) std::atof(value);
+        else if (std::strcmp(arg, "--width") == 0) width = std::atoi(value);
+        else if (std::strcmp(arg, "--height") == 0) height = std::atoi(value);
+        else if (std::strcmp(arg, "--cells") == 0) cellsPerTeam = std::atoi(value);
+        else if (std::strcmp(arg, "--threads") == 0) threads = std::atoi(value);
+        else if (std::strcmp(arg, "--load") == 0) loadPath = value;
+        else if (std::strcmp(arg, "--save") == 0) savePath = value;
+        else if (std::strcmp(arg, "--record") == 0) recordPath = value;
+        else if (std::strcmp(arg, "--telemetry") == 0) telemetryPath = value;
+        else if (std::strcmp(arg, "--telemetry-interval") == 0) telemetryInterval = std::atoi(value);
+        else if (std::strcmp(arg, "--trace") == 0) tracePath = value;
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (tracePath != nullptr && !Trace::enabled())
+    {
+        std::fprintf(stderr, "--trace needs a build configured with -DCELL_BATTLES_TRACE=ON\n");
+        return 1;
+    }
+
+    // Leaves room for the spawn circles of WorldSettings::standard
+    if (width < MIN_WORLD_SIZE || height < MIN_WORLD_SIZE)
+    {
+        std::fprintf(stderr, "--width and --height must be at least %d\n", MIN_WORLD_SIZE);
+        return 1;
+    }
+
+    WorldSettings settings = WorldSettings::standard(width, height);
+    if (cellsPerTeam >= 0) settings.initialCellsPerTeam = cellsPerTeam;
+    settings.numThreads = threads;
+
+    if (batch)
+    {
+        if (loadPath != nullptr || savePath != nullptr || recordPath != nullptr || telemetryPath != nullptr ||
+            verify || checkPhases)
+        {
+            std::fprintf(stderr, "--batch can't be combined with --load, --save, --record, --telemetry, --verify or "
+                                 "--check-phases\n");
+            return 1;
+        }
+
+        std::vector<BatchJob> jobs;
+        for (int run = 0; run < runs; run++)
+            jobs.push_back({settings, seed + run, steps, dt});
+
+        auto start = std::chrono::steady_clock::now();
+        auto results = BatchRunner(threads).run(jobs);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        for (auto& result: results)
+        {
+            std::fprintf(stderr, "seed %d: %d steps in %.3fs (%.1f steps/s), state hash %016llx\n",
+                         result.seed, steps, result.seconds, steps / result.seconds,
+                         (unsigned long long) result.stateHash);
+        }
+        std::fprintf(stderr, "%d runs in %.3fs (%.1f steps/s)\n", runs, elapsed.count(),
+                     (double) runs * steps / elapsed.count());
+
+        BatchRunner::writeCsv(stdout, results);
+        return tracePath != nullptr && !Trace::writeChromeJson(tracePath) ? 1 : 0;
+    }
+
+    Telemetry telemetry;
+    if (telemetryPath != nullptr && !telemetry.open(telemetryPath, settings.numTeams, telemetryInterval))
+        return 1;
+
+    WorldSettings referenceSettings = settings;
+    referenceSettings.numThreads = 1;
+
+    std::printf("seed,team,cells,owned_chunks,attack,defense,speed,metabolism\n");
+    for (int run = 0; run < runs; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        World world(settings, seed + run);
+        std::unique_ptr<World> reference;
+        if (verify) reference = std::make_unique<World>(referenceSettings, seed + run);
+
+        if (loadPath != nullptr)
+        {
+            if (!world.loadSnapshot(loadPath) || (reference && !reference->loadSnapshot(loadPath)))
+                return 1;
+            world.reseed(seed + run);
+            if (reference) reference->reseed(seed + run);
+        }
+
+        world.timePhases = telemetryPath != nullptr;
+        world.checkPhaseAccess = checkPhases;
+        telemetry.beginRun(world, seed + run);
+
+        ReplayRecorder recorder;
+        bool recording = recordPath != nullptr && run == runs - 1;
+        if (recording && (!recorder.open(recordPath, world) || !recorder.record(world)))
+            return 1;
+        std::vector<std::vector<TeamStats>> recordedStats;
+        if (recording && verify) recordedStats.push_back(world.getTeamStats());
+
+        for (int i = 0; i < steps; i++)
+        {
+            world.step(dt);
+            telemetry.sample(world);
+            if (recording && !recorder.record(world))
+                return 1;
+            if (recording && verify) recordedStats.push_back(world.getTeamStats());
+            if (!reference) continue;
+
+            reference->step(dt);
+            if (world.stateHash() != reference->stateHash())
+            {
+                std::fprintf(stderr, "seed %d: state diverged from the single threaded run at step %d\n",
+                             seed + run, i + 1);
+                return 1;
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::fprintf(stderr, "seed %d: %d steps in %.3fs (%.1f steps/s), state hash %016llx\n",
+                     seed + run, steps, elapsed.count(), steps / elapsed.count(),
+                     (unsigned long long) world.stateHash());
+
+        auto stats = world.getTeamStats();
+        for (size_t team = 0; team < stats.size(); team++)
+        {
+            auto& s = stats[team];
+            std::printf("%d,%zu,%d,%d,%f,%f,%f,%f\n", seed + run, team, s.cellCount, s.ownedChunks,
+                        s.averageAttack, s.averageDefense, s.averageSpeed, s.averageMetabolism);
+        }
+        std::fflush(stdout);
+
+        if (savePath != nullptr && run == runs - 1 && !world.saveSnapshot(savePath))
+            return 1;
+        if (recording && !recorder.close())
+            return 1;
+        if (recording && verify && !verifyReplay(recordPath, recordedStats))
+            return 1;
+    }
+
+    if (tracePath != nullptr && !Trace::writeChromeJson(tracePath))
+        return 1;
+
+    return 0;
+}
@@ -1,47 +1,186 @@
 #include <SFML/Graphics.hpp>
+#include "world/frame_exchange.h"
+#include "world/frame_renderer.h"
+#include "world/replay_player.h"
+#include "world/replay_recorder.h"
+#include "world/trace.h"
 #include "world/world.h"
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
 
-int main()
+// Runs the game. --record PATH writes every step to a replay; --replay PATH plays one back instead of running a
+// world.
+int main(int argc, char** argv)
 {
+    const char* recordPath = nullptr;
+    const char* replayPath = nullptr;
+    bool validArgs = true;
+    for (int i = 1; validArgs && i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) recordPath = argv[++i];
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replayPath = argv[++i];
+        else validArgs = false;
+    }
+
+    // A replay runs no world to record
+    if (!validArgs || (recordPath != nullptr && replayPath != nullptr))
+    {
+        std::fprintf(stderr, "Usage: %s [--record PATH | --replay PATH]\n", argv[0]);
+        return 1;
+    }
+
     sf::ContextSettings windowSettings;
     windowSettings.antialiasingLevel = 8;
 
     constexpr int WIDTH = 1920;
     constexpr int HEIGHT = 1080;
 
+    // Size of the world in world units, independent of the window
+    constexpr int WORLD_WIDTH = 1920;
+    constexpr int WORLD_HEIGHT = 1080;
+
+    // Arrow keys and WASD pan the camera by this fraction of the view per second; each wheel notch zooms by ZOOM_STEP
+    constexpr float PAN_SPEED = 1.f;
+    constexpr float ZOOM_STEP = 1.1f;
+
+    // The world is always stepped by STEP_DT, so a seed plays out the same whatever the frame rate. When the
+    // simulation falls further behind real time than MAX_STEPS_BEHIND steps it slows down instead of stalling. F4
+    // switches to stepping as fast as the cores allow.
+    constexpr float STEP_DT = 1.f / 60.f;
+    constexpr int MAX_STEPS_BEHIND = 8;
+
+    // The world steps on its own thread and hands frames to this one through frames, so drawing and stepping never
+    // wait on each other. Frames cover the view plus this fraction of its size on every side, so panning doesn't
+    // outrun them between captures.
+    constexpr float CAPTURE_MARGIN = 0.5f;
+
+    // Replays play at 1 frame per STEP_DT times the speed, which +/- double or halve within these bounds. PageUp and
+    // PageDown jump by REPLAY_JUMP frames.
+    constexpr float MIN_REPLAY_SPEED = 1.f / 16.f;
+    constexpr float MAX_REPLAY_SPEED = 64.f;
+    constexpr int REPLAY_JUMP = 600;
+
+    ReplayPlayer player;
+    if (replayPath != nullptr && !player.open(replayPath))
+        return 1;
+
     sf::RenderWindow window(sf::VideoMode(WIDTH, HEIGHT), "Cell Battles",
                             sf::Style::Default, windowSettings);
     window.setFramerateLimit(0);
-    window.setVerticalSyncEnabled(false);
+    window.setVerticalSyncEnabled(true);
 
-    WorldSettings worldSettings;
-    worldSettings.width = WIDTH;
-    worldSettings.height = HEIGHT;
+    WorldSettings worldSettings = WorldSettings::standard(WORLD_WIDTH, WORLD_HEIGHT);
 
-    worldSettings.pixelsPerChunk = 10;
+    // No world runs while a replay plays
+    std::unique_ptr<World> world;
+    if (replayPath == nullptr) world = std::make_unique<World>(worldSettings, 3211);
+    FrameExchange frames;
+    FrameRenderer renderer;
 
-    worldSettings.numTeams = 4;
-    worldSettings.cellRadius = 3;
-    worldSettings.initialCellsPerTeam = 10;
-    worldSettings.cellAttackRange = 10;
-    worldSettings.supplyDiffusionRate = 1.f;
+    ReplayRecorder recorder;
+    if (recordPath != nullptr && (!recorder.open(recordPath, *world) || !recorder.record(*world)))
+        return 1;
 
-    worldSettings.teamColors = {
-            sf::Color::Green,
-            sf::Color::Red,
-            sf::Color::Yellow,
-            sf::Color::Blue
-    };
-    worldSettings.teamSpawns = {
-            {300,        300},
-            {300,        1080 - 300},
-            {1920 - 300, 300},
-            {1920 - 300, 1080 - 300}
+    // Frame of the replay shown, kept fractional so slow speeds still advance, and how it plays
+    double replayPosition = 0;
+    float replaySpeed = 1;
+    bool replayReverse = false;
+    bool replayPaused = false;
+    WorldFrame replayFrame;
+
+    // Read by the simulation thread between steps
+    std::atomic<bool> running{true};
+    std::atomic<bool> fastForward{false};
+    std::atomic<int> viewMode{DEFAULT};
+    std::mutex viewMutex;
+    sf::FloatRect viewArea(0, 0, WORLD_WIDTH, WORLD_HEIGHT);
+
+    // Held by the simulation thread while it steps, so that traces are written while no thread records
+    std::mutex stepMutex;
+
+    auto stepWorld = [&]()
+    {
+        world->step(STEP_DT);
+        if (recordPath != nullptr) recorder.record(*world);
     };
-    worldSettings.spawnRadius = 5;
 
-    World world = World(worldSettings, 3211);
+    std::thread simulation;
+    if (world) simulation = std::thread([&]()
+    {
+        auto lastTime = std::chrono::steady_clock::now();
+        float accumulator = 0;
+        sf::FloatRect capturedArea;
+        bool stale = true;
+
+        while (running)
+        {
+            std::unique_lock<std::mutex> lock(stepMutex);
+            auto now = std::chrono::steady_clock::now();
+            accumulator += std::chrono::duration<float>(now - lastTime).count();
+            lastTime = now;
+
+            if (fastForward)
+            {
+                stepWorld();
+                accumulator = 0;
+                stale = true;
+            }
+            else
+            {
+                int numSteps = 0;
+                while (accumulator >= STEP_DT && numSteps < MAX_STEPS_BEHIND)
+                {
+                    stepWorld();
+                    accumulator -= STEP_DT;
+                    numSteps++;
+                }
+                if (numSteps == MAX_STEPS_BEHIND) accumulator = 0;
+                stale |= numSteps > 0;
+            }
+
+            sf::FloatRect area;
+            {
+                std::lock_guard<std::mutex> viewLock(viewMutex);
+                area = viewArea;
+            }
+            stale |= area != capturedArea || world->viewMode != viewMode;
+
+            // Frames the display never took would be wasted, so capture only once it took the last one
+            if (stale && frames.wasTaken())
+            {
+                world->viewMode = (ViewMode) viewMode.load();
+                sf::Vector2f margin = sf::Vector2f(area.width, area.height) * CAPTURE_MARGIN;
+                world->captureFrame(frames.getBackFrame(), sf::FloatRect(area.left - margin.x, area.top - margin.y,
+                                                                         area.width + 2 * margin.x,
+                                                                         area.height + 2 * margin.y));
+                frames.publish();
+                capturedArea = area;
+                stale = false;
+            }
+            lock.unlock();
+
+            // Sleep until the next step is due, or briefly if a frame is waiting to be taken
+            if (!fastForward)
+            {
+                float wait = stale ? std::min(STEP_DT - accumulator, 0.001f) : STEP_DT - accumulator;
+                std::this_thread::sleep_for(std::chrono::duration<float>(std::max(0.f, wait)));
+            }
+        }
+    });
+
+    // The camera starts on the whole world. Dragging with the right or middle button also pans it, the wheel zooms
+    // around the cursor and Home resets it. The stats are drawn in window coordinates through hudView.
+    const sf::View fullView(sf::FloatRect(0, 0, WORLD_WIDTH, WORLD_HEIGHT));
+    sf::View camera = fullView;
+    sf::View hudView(sf::FloatRect(0, 0, WIDTH, HEIGHT));
+    bool dragging = false;
+    sf::Vector2i dragPos;
 
     sf::Font robotoFont;
     robotoFont.loadFromFile("roboto/Roboto-Light.ttf");
@@ -54,21 +193,91 @@ int main()
     auto lastTime = std::chrono::steady_clock::now().time_since_epoch().count();
     while (window.isOpen())
     {
+        TRACE_SCOPE("frame");
+
         sf::Event event;
         while (window.pollEvent(event))
         {
             if (event.type == sf::Event::Closed)
                 window.close();
+            else if (event.type == sf::Event::Resized)
+            {
+                // Keep the scale, so a bigger window shows more of the world
+                sf::Vector2f scale = {camera.getSize().x / hudView.getSize().x, camera.getSize().y / hudView.getSize().y};
+                hudView.reset(sf::FloatRect(0, 0, (float) event.size.width, (float) event.size.height));
+                camera.setSize(scale.x * (float) event.size.width, scale.y * (float) event.size.height);
+            }
+            else if (event.type == sf::Event::MouseWheelScrolled &&
+                     event.mouseWheelScroll.wheel == sf::Mouse::VerticalWheel)
+            {
+                // Zoom around the cursor, so the point under it stays put
+                sf::Vector2i cursor = {event.mouseWheelScroll.x, event.mouseWheelScroll.y};
+                sf::Vector2f before = window.mapPixelToCoords(cursor, camera);
+                camera.zoom(std::pow(ZOOM_STEP, -event.mouseWheelScroll.delta));
+                camera.move(before - window.mapPixelToCoords(cursor, camera));
+            }
+            else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button != sf::Mouse::Left)
+            {
+                dragging = true;
+                dragPos = {event.mouseButton.x, event.mouseButton.y};
+            }
+            else if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button != sf::Mouse::Left)
+                dragging = false;
+            else if (event.type == sf::Event::MouseMoved && dragging)
+            {
+                sf::Vector2i mousePos = {event.mouseMove.x, event.mouseMove.y};
+                camera.move(window.mapPixelToCoords(dragPos, camera) - window.mapPixelToCoords(mousePos, camera));
+                dragPos = mousePos;
+            }
             else if (event.type == sf::Event::KeyPressed)
             {
                 if (event.key.code == sf::Keyboard::F1)
-                    world.viewMode = DEFAULT;
+                    viewMode = DEFAULT;
                 else if (event.key.code == sf::Keyboard::F2)
-                    world.viewMode = SUPPLY;
+                    viewMode = SUPPLY;
                 else if(event.key.code == sf::Keyboard::F3)
-                    world.viewMode = SUPPLY_GENERATION;
+                    viewMode = SUPPLY_GENERATION;
+                else if(event.key.code == sf::Keyboard::F4)
+                    fastForward = !fastForward;
+                else if(event.key.code == sf::Keyboard::Home)
+                {
+                    camera = fullView;
+                    // Fit the world's width to the window's aspect ratio
+                    camera.setSize(fullView.getSize().x,
+                                   fullView.getSize().x * hudView.getSize().y / hudView.getSize().x);
+                }
+                else if(event.key.code == sf::Keyboard::F12 && Trace::enabled())
+                {
+                    // The last few seconds of frames, for chrome://tracing or Perfetto
+                    std::lock_guard<std::mutex> lock(stepMutex);
+                    if (Trace::writeChromeJson("cell-battles-trace.json"))
+                        std::printf("Wrote cell-battles-trace.json\n");
+                }
                 else if(event.key.code == sf::Keyboard::Escape)
-                    std::exit(0);
+                    window.close();
+                else if (replayPath != nullptr)
+                {
+                    // Replay controls: Space pauses, R reverses, +/- change the speed, PageUp/PageDown jump and ,/.
+                    // step a frame back or forward
+                    if (event.key.code == sf::Keyboard::Space)
+                        replayPaused = !replayPaused;
+                    else if(event.key.code == sf::Keyboard::R)
+                        replayReverse = !replayReverse;
+                    else if(event.key.code == sf::Keyboard::Equal || event.key.code == sf::Keyboard::Add)
+                        replaySpeed = std::min(replaySpeed * 2, MAX_REPLAY_SPEED);
+                    else if(event.key.code == sf::Keyboard::Hyphen || event.key.code == sf::Keyboard::Subtract)
+                        replaySpeed = std::max(replaySpeed / 2, MIN_REPLAY_SPEED);
+                    else if(event.key.code == sf::Keyboard::PageUp)
+                        replayPosition -= REPLAY_JUMP;
+                    else if(event.key.code == sf::Keyboard::PageDown)
+                        replayPosition += REPLAY_JUMP;
+                    else if(event.key.code == sf::Keyboard::Comma || event.key.code == sf::Keyboard::Period)
+                    {
+                        replayPaused = true;
+                        replayPosition = std::floor(replayPosition);
+                        replayPosition += event.key.code == sf::Keyboard::Comma ? -1 : 1;
+                    }
+                }
             }
         }
 
@@ -76,18 +285,61 @@ int main()
         float delta = (float) (now - lastTime) / 1000000000.f;
         float fps = 1.f / delta;
 
-        if (delta > 0.2) delta = 0.2;
-        world.step(delta);
+        sf::Vector2f pan;
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Left) || sf::Keyboard::isKeyPressed(sf::Keyboard::A))
+            pan.x -= 1;
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Right) || sf::Keyboard::isKeyPressed(sf::Keyboard::D))
+            pan.x += 1;
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Up) || sf::Keyboard::isKeyPressed(sf::Keyboard::W))
+            pan.y -= 1;
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Down) || sf::Keyboard::isKeyPressed(sf::Keyboard::S))
+            pan.y += 1;
+        camera.move(pan.x * camera.getSize().x * PAN_SPEED * delta, pan.y * camera.getSize().y * PAN_SPEED * delta);
+
         lastTime = now;
 
-        statsText.setString(std::string("FPS: ") + std::to_string(fps) +
-            "\n" + world.getStats());
+        window.setView(camera);
+        sf::FloatRect visibleArea = FrameRenderer::getVisibleArea(window, sf::Transform::Identity);
+        {
+            std::lock_guard<std::mutex> lock(viewMutex);
+            viewArea = visibleArea;
+        }
+
+        char line[128];
+        std::snprintf(line, sizeof(line), "FPS: %.1f%s\n", fps, fastForward ? ", fast forward" : "");
+        std::string stats = line;
+
+        if (replayPath != nullptr)
+        {
+            if (!replayPaused)
+                replayPosition += (replayReverse ? -1 : 1) * replaySpeed * delta / STEP_DT;
+            replayPosition = std::min(std::max(replayPosition, 0.), (double) player.getNumFrames() - 1);
+            player.seek((int64_t) replayPosition);
+            player.captureFrame(replayFrame, visibleArea);
+
+            std::snprintf(line, sizeof(line), "Replay: %.1fs, frame %u/%u, %s%gx%s\n", player.getWorldTime(),
+                          player.getFrame() + 1, player.getNumFrames(), replayReverse ? "-" : "", replaySpeed,
+                          replayPaused ? ", paused" : "");
+            stats += line;
+        }
+        const WorldFrame& frame = replayPath != nullptr ? replayFrame : frames.acquire();
+
+        for (auto& team: frame.teamStats)
+        {
+            std::snprintf(line, sizeof(line), "%d cells, %d chunks: %f,%f,%f,%f\n", team.cellCount, team.ownedChunks,
+                          team.averageAttack, team.averageDefense, team.averageSpeed, team.averageMetabolism);
+            stats += line;
+        }
+        statsText.setString(stats);
 
         window.clear();
-        window.draw(world);
+        renderer.draw(window, frame);
+        window.setView(hudView);
         window.draw(statsText);
         window.display();
     }
 
-    return 0;
+    running = false;
+    if (simulation.joinable()) simulation.join();
+    return recorder.close() ? 0 : 1;
 }
\ No newline at end of file
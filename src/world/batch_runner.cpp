@@ -0,0 +1,91 @@
+#include "world/batch_runner.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "world/trace.h"
+#include "world/world.h"
+
+// True if a world built with a can be reset into one built with b. Thread counts don't matter.
+static bool sameSettings(const WorldSettings& a, const WorldSettings& b)
+{
+    auto sameColors = [](const std::vector<sf::Color>& x, const std::vector<sf::Color>& y)
+    {
+        return std::equal(x.begin(), x.end(), y.begin(), y.end());
+    };
+    auto sameSpawns = [](const std::vector<sf::Vector2f>& x, const std::vector<sf::Vector2f>& y)
+    {
+        return std::equal(x.begin(), x.end(), y.begin(), y.end());
+    };
+
+    return a.width == b.width && a.height == b.height && a.pixelsPerChunk == b.pixelsPerChunk &&
+           a.cellRadius == b.cellRadius && a.cellAttackRange == b.cellAttackRange && a.numTeams == b.numTeams &&
+           a.initialCellsPerTeam == b.initialCellsPerTeam && sameColors(a.teamColors, b.teamColors) &&
+           sameSpawns(a.teamSpawns, b.teamSpawns) && a.spawnRadius == b.spawnRadius &&
+           a.supplyDiffusionRate == b.supplyDiffusionRate && a.childSpawnDelay == b.childSpawnDelay &&
+           a.speed == b.speed;
+}
+
+BatchRunner::BatchRunner(int numThreads)
+{
+    if (numThreads <= 0) numThreads = (int) std::thread::hardware_concurrency();
+    pool.resize(std::max(0, numThreads - 1));
+}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob>& jobs)
+{
+    std::vector<BatchResult> results(jobs.size());
+    std::atomic<size_t> nextJob(0);
+
+    auto worker = [&]()
+    {
+        std::unique_ptr<World> world;
+        const WorldSettings* worldSettings = nullptr;
+
+        for (size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+        {
+            TRACE_SCOPE("batchJob");
+            auto& job = jobs[i];
+            auto start = std::chrono::steady_clock::now();
+
+            if (world && sameSettings(*worldSettings, job.settings))
+            {
+                world->reset(job.seed);
+            }
+            else
+            {
+                // Worlds split their phases over the runner's pool, so threads without a world of their own help
+                // with the others'
+                world = std::make_unique<World>(job.settings, job.seed, pool);
+                worldSettings = &job.settings;
+            }
+
+            for (int step = 0; step < job.steps; step++)
+                world->step(job.delta);
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            results[i] = {job.seed, world->getTeamStats(), world->stateHash(), elapsed.count()};
+        }
+    };
+
+    // The calling thread works through jobs too instead of idling
+    size_t numWorkers = std::min((size_t) pool.size() + 1, jobs.size());
+    pool.parallel_for(numWorkers, numWorkers, [&](size_t, size_t, size_t) { worker(); });
+
+    return results;
+}
+
+void BatchRunner::writeCsv(FILE* file, const std::vector<BatchResult>& results)
+{
+    std::fprintf(file, "seed,team,cells,owned_chunks,attack,defense,speed,metabolism\n");
+    for (auto& result: results)
+    {
+        for (size_t team = 0; team < result.teams.size(); team++)
+        {
+            auto& s = result.teams[team];
+            std::fprintf(file, "%d,%zu,%d,%d,%f,%f,%f,%f\n", result.seed, team, s.cellCount, s.ownedChunks,
+                         s.averageAttack, s.averageDefense, s.averageSpeed, s.averageMetabolism);
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#include "world/cell_store.h"
+
+CellHandle CellStore::add(const Cell& cell)
+{
+    CellHandle h;
+    if (!freeHandles.empty())
+    {
+        h = freeHandles.back();
+        freeHandles.pop_back();
+    }
+    else
+    {
+        h = (CellHandle) handleToIndex.size();
+        handleToIndex.push_back(0);
+    }
+    handleToIndex[h] = (uint32_t) size();
+
+    handle.push_back(h);
+    teamId.push_back(cell.teamId);
+    seed.push_back(cell.seed);
+
+    attack.push_back(cell.attack);
+    defense.push_back(cell.defense);
+    speed.push_back(cell.speed);
+    metabolism.push_back(cell.metabolism);
+
+    health.push_back(cell.health);
+    supply.push_back(cell.supply);
+    childProgress.push_back(cell.childProgress);
+    numChildren.push_back(cell.numChildren);
+    velocity.push_back(cell.velocity);
+    preferredVelocity.push_back(cell.preferredVelocity);
+    position.push_back(cell.position);
+    chunkSlot.push_back(0);
+
+    return h;
+}
+
+void CellStore::reset(size_t count)
+{
+    freeHandles.clear();
+    forEachField([&](auto& field)
+    {
+        field.clear();
+        field.resize(count);
+    });
+
+    handleToIndex.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        handle[i] = (CellHandle) i;
+        handleToIndex[i] = (uint32_t) i;
+    }
+}
+
+void CellStore::removeDead(size_t first)
+{
+    size_t write = first;
+    for (size_t read = first; read < size(); read++)
+    {
+        if (health[read] <= 0)
+        {
+            freeHandles.push_back(handle[read]);
+            continue;
+        }
+
+        if (write != read)
+            forEachField([&](auto& field) { field[write] = field[read]; });
+        handleToIndex[handle[write]] = (uint32_t) write;
+        write++;
+    }
+
+    forEachField([&](auto& field) { field.resize(write); });
+}
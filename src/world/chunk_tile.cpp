@@ -0,0 +1,45 @@
+#include "world/chunk_tile.h"
+#include <algorithm>
+
+ChunkTile::ChunkTile(int numTeams) :
+        numTeams(numTeams), supply(), development(), full(), claimed(), claimable(), edge(), demand(), active(),
+        territoryDirty(), ownership(CHUNK_TILE_AREA * numTeams)
+{
+    std::fill(owner, owner + CHUNK_TILE_AREA, -1);
+}
+
+int ChunkTile::getCurrentOwner(int index) const
+{
+    const float* teamOwnership = &ownership[index * numTeams];
+    for (int i = 0; i < numTeams; i++)
+        if (teamOwnership[i] == 1.f) return i;
+        else if (teamOwnership[i] != 0.f) return -1;
+    return -1;
+}
+
+void ChunkTile::allocateCells()
+{
+    if (!cells.empty()) return;
+    cells.resize(CHUNK_TILE_AREA * numTeams);
+    steering.resize(CHUNK_TILE_AREA * numTeams);
+    steeringStamp.resize(CHUNK_TILE_AREA * numTeams);
+}
+
+void ChunkTile::clear()
+{
+    std::fill(supply, supply + CHUNK_TILE_AREA, 0.f);
+    std::fill(development, development + CHUNK_TILE_AREA, 0.f);
+    std::fill(owner, owner + CHUNK_TILE_AREA, -1);
+    std::fill(full, full + CHUNK_TILE_AREA, 0);
+    std::fill(claimed, claimed + CHUNK_TILE_AREA, 0);
+    std::fill(claimable, claimable + CHUNK_TILE_AREA, 0);
+    std::fill(edge, edge + CHUNK_TILE_AREA, 0);
+    std::fill(demand, demand + CHUNK_TILE_AREA, 0.f);
+    std::fill(active, active + CHUNK_TILE_AREA, false);
+    std::fill(territoryDirty, territoryDirty + CHUNK_TILE_AREA, false);
+    std::fill(ownership.begin(), ownership.end(), 0.f);
+
+    for (auto& teamCells: cells)
+        teamCells.clear();
+    std::fill(steeringStamp.begin(), steeringStamp.end(), 0);
+}
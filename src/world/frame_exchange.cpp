@@ -0,0 +1,20 @@
+#include "world/frame_exchange.h"
+
+void FrameExchange::publish()
+{
+    // Releases the writes to the back frame to the reader, and acquires the reader's last writes, if any, to the
+    // frame coming back
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
+
+bool FrameExchange::wasTaken() const
+{
+    return !(middle.load(std::memory_order_relaxed) & FRESH);
+}
+
+const WorldFrame& FrameExchange::acquire()
+{
+    if (middle.load(std::memory_order_relaxed) & FRESH)
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+    return frames[front];
+}
@@ -0,0 +1,166 @@
+#include "world/frame_renderer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "world/trace.h"
+
+#define PI_f 3.14159265359f
+
+// Cells are drawn as octagons, triangulated into CELL_SEGMENTS - 2 triangles
+#define CELL_SEGMENTS 8
+#define VERTICES_PER_CELL ((CELL_SEGMENTS - 2) * 3)
+
+// Rows of chunks per overlay upload band
+#define OVERLAY_BAND_ROWS 16
+
+sf::FloatRect FrameRenderer::getVisibleArea(const sf::RenderTarget& target, const sf::Transform& transform)
+{
+    const sf::View& view = target.getView();
+    sf::FloatRect viewArea(view.getCenter() - view.getSize() / 2.f, view.getSize());
+    return transform.getInverse().transformRect(viewArea);
+}
+
+void FrameRenderer::draw(sf::RenderTarget& target, const WorldFrame& frame, sf::RenderStates states)
+{
+    TRACE_SCOPE("draw");
+    sf::FloatRect visibleArea = getVisibleArea(target, states.transform);
+    if (frame.overlayTiles.empty() || !visibleArea.intersects(sf::FloatRect({0, 0}, frame.size)))
+        return;
+
+    // A frame of another world starts over
+    if (overlayTextures.size() != frame.overlayTiles.size())
+    {
+        overlayTextures.clear();
+        overlayTextures.resize(frame.overlayTiles.size());
+    }
+
+    sf::Vector2i firstTile = getClampedChunkPos({visibleArea.left, visibleArea.top}, frame.pixelsPerChunk,
+                                                frame.numChunks) / OVERLAY_TILE_CHUNKS;
+    sf::Vector2i lastTile = getClampedChunkPos({visibleArea.left + visibleArea.width,
+                                                visibleArea.top + visibleArea.height}, frame.pixelsPerChunk,
+                                               frame.numChunks) / OVERLAY_TILE_CHUNKS;
+
+    for (int y = firstTile.y; y <= lastTile.y; y++)
+    {
+        for (int x = firstTile.x; x <= lastTile.x; x++)
+        {
+            int index = x + y * frame.numOverlayTiles.x;
+            auto& tile = frame.overlayTiles[index];
+            bool captured = x >= frame.firstTile.x && x <= frame.lastTile.x &&
+                    y >= frame.firstTile.y && y <= frame.lastTile.y;
+            if (captured && tile.version != 0 && tile.version != overlayTextures[index].version)
+                uploadOverlayTile(tile, index);
+
+            if (overlayTextures[index].version == 0) continue;
+            sf::Sprite sprite(overlayTextures[index].texture);
+            sprite.setPosition(sf::Vector2f(sf::Vector2i(x, y) * OVERLAY_TILE_CHUNKS) * frame.pixelsPerChunk);
+            sprite.setScale(frame.pixelsPerChunk, frame.pixelsPerChunk);
+            target.draw(sprite, states);
+        }
+    }
+
+    drawCells(target, frame, states, visibleArea);
+}
+
+void FrameRenderer::uploadOverlayTile(const WorldFrame::OverlayTile& tile, int index)
+{
+    TRACE_SCOPE("uploadOverlayTile");
+    auto& texture = overlayTextures[index];
+    sf::Vector2i size = tile.size;
+    texture.version = tile.version;
+
+    if (texture.pixels.empty())
+    {
+        // Created on first sight, so parts of the world that are never looked at don't need textures
+        texture.texture.create(size.x, size.y);
+        texture.pixels = tile.pixels;
+        texture.texture.update(texture.pixels.data());
+        return;
+    }
+
+    // Frames only say that something in the tile changed, so find the changed columns of each band of rows by
+    // comparing against what was uploaded
+    for (int top = 0; top < size.y; top += OVERLAY_BAND_ROWS)
+    {
+        int rows = std::min(OVERLAY_BAND_ROWS, size.y - top);
+        int left = size.x;
+        int right = 0;
+        for (int row = top; row < top + rows; row++)
+        {
+            const sf::Uint8* oldRow = &texture.pixels[row * size.x * 4];
+            const sf::Uint8* newRow = &tile.pixels[row * size.x * 4];
+            if (std::memcmp(oldRow, newRow, size.x * 4) == 0) continue;
+
+            int first = 0;
+            while (std::memcmp(oldRow + first * 4, newRow + first * 4, 4) == 0) first++;
+            int last = size.x - 1;
+            while (std::memcmp(oldRow + last * 4, newRow + last * 4, 4) == 0) last--;
+            left = std::min(left, first);
+            right = std::max(right, last + 1);
+        }
+        if (left >= right) continue;
+
+        TRACE_COUNTER("bands", 1);
+        int width = right - left;
+        for (int row = top; row < top + rows; row++)
+        {
+            std::copy_n(&tile.pixels[(left + row * size.x) * 4], width * 4,
+                        &texture.pixels[(left + row * size.x) * 4]);
+        }
+
+        const sf::Uint8* pixels = &texture.pixels[(left + top * size.x) * 4];
+        if (width != size.x)
+        {
+            // Texture::update wants tightly packed rows, so gather the span of each row
+            uploadBuffer.resize(width * rows * 4);
+            for (int row = 0; row < rows; row++)
+                std::copy_n(pixels + row * size.x * 4, width * 4, &uploadBuffer[row * width * 4]);
+            pixels = uploadBuffer.data();
+        }
+
+        texture.texture.update(pixels, width, rows, left, top);
+    }
+}
+
+void FrameRenderer::drawCells(sf::RenderTarget& target, const WorldFrame& frame, sf::RenderStates states,
+                              sf::FloatRect visibleArea)
+{
+    TRACE_SCOPE("drawCells");
+
+    // Octagon corners, matching an 8 point sf::CircleShape
+    sf::Vector2f corners[CELL_SEGMENTS];
+    for (int i = 0; i < CELL_SEGMENTS; i++)
+    {
+        float angle = (float) i * 2.f * PI_f / CELL_SEGMENTS - PI_f / 2.f;
+        corners[i] = frame.cellRadius * sf::Vector2f(cosf(angle), sinf(angle));
+    }
+
+    sf::FloatRect area = getCellCullArea(visibleArea, frame.cellRadius);
+
+    // The buffer only grows, so steady frames reuse it without reallocating
+    size_t numCells = frame.cellPositions.size();
+    if (cellVertices.size() < numCells * VERTICES_PER_CELL)
+        cellVertices.resize(numCells * VERTICES_PER_CELL);
+
+    size_t numVertices = 0;
+    for (size_t i = 0; i < numCells; i++)
+    {
+        auto position = frame.cellPositions[i];
+        if (!area.contains(position)) continue;
+        auto color = frame.cellColors[i];
+
+        // Fan the octagon out from its first corner
+        sf::Vertex* vertex = &cellVertices[numVertices];
+        for (int k = 1; k < CELL_SEGMENTS - 1; k++)
+        {
+            *vertex++ = sf::Vertex(position + corners[0], color);
+            *vertex++ = sf::Vertex(position + corners[k], color);
+            *vertex++ = sf::Vertex(position + corners[k + 1], color);
+        }
+        numVertices += VERTICES_PER_CELL;
+    }
+
+    TRACE_COUNTER("cells", numVertices / VERTICES_PER_CELL);
+    if (numVertices > 0)
+        target.draw(cellVertices.data(), numVertices, sf::Triangles, states);
+}
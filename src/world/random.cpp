@@ -0,0 +1,33 @@
+#include "world/random.h"
+
+static uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+Random::Random(uint64_t seed, uint64_t stream, uint64_t index) :
+        state(mix(mix(mix(seed) ^ stream) ^ index))
+{
+
+}
+
+uint64_t Random::next()
+{
+    state += 0x9e3779b97f4a7c15ULL;
+    return mix(state);
+}
+
+float Random::uniform(float min, float max)
+{
+    // Top 24 bits, exactly representable as a float
+    float unit = (float) (next() >> 40) * (1.f / 16777216.f);
+    return min + (max - min) * unit;
+}
+
+int Random::uniformInt(int min, int max)
+{
+    uint64_t range = (uint64_t) ((int64_t) max - (int64_t) min) + 1;
+    return (int) ((int64_t) min + (int64_t) (next() % range));
+}
@@ -0,0 +1,413 @@
+#include "world/replay_player.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+#include "utils.h"
+#include "world/trace.h"
+
+bool ReplayPlayer::open(const std::string& path)
+{
+    this->path = path;
+    segments.clear();
+    numFrames = 0;
+    loadedSegment = -1;
+    currentFrame = 0;
+
+    file.close();
+    file.clear();
+    file.open(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open replay \"" << path << "\"" << std::endl;
+        return false;
+    }
+
+    if (!file.read((char*) &header, sizeof(header)) ||
+        std::memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0)
+    {
+        std::cerr << "\"" << path << "\" is not a replay" << std::endl;
+        return false;
+    }
+    if (header.version != REPLAY_VERSION || header.byteOrder != REPLAY_BYTE_ORDER)
+    {
+        std::cerr << "Replay \"" << path << "\" was written by an incompatible version or machine" << std::endl;
+        return false;
+    }
+    if (header.numTeams < 1 || header.numTeams > 64 || header.numChunksX < 1 || header.numChunksY < 1 ||
+        header.positionScale < 1 || !(header.pixelsPerChunk > 0))
+    {
+        std::cerr << "Replay \"" << path << "\" is corrupt" << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> colors(header.numTeams * 4);
+    if (!file.read((char*) colors.data(), (std::streamsize) colors.size()))
+    {
+        std::cerr << "Replay \"" << path << "\" is corrupt" << std::endl;
+        return false;
+    }
+    teamColors.clear();
+    for (int i = 0; i < header.numTeams; i++)
+        teamColors.emplace_back(colors[i * 4], colors[i * 4 + 1], colors[i * 4 + 2], colors[i * 4 + 3]);
+
+    // Index the segments, stopping at the first one the file doesn't hold all of
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+    std::streamoff offset = (std::streamoff) (sizeof(header) + colors.size());
+    while (offset + (std::streamoff) sizeof(ReplaySegmentHeader) <= fileSize)
+    {
+        Segment segment{};
+        file.seekg(offset);
+        if (!file.read((char*) &segment.header, sizeof(segment.header))) break;
+        segment.offset = offset + (std::streamoff) sizeof(segment.header);
+        if (segment.offset + segment.header.compressedSize > fileSize) break;
+
+        if (segment.header.firstFrame != numFrames || segment.header.numFrames == 0)
+        {
+            std::cerr << "Replay \"" << path << "\" is corrupt" << std::endl;
+            return false;
+        }
+        segments.push_back(segment);
+        numFrames += segment.header.numFrames;
+        offset = segment.offset + segment.header.compressedSize;
+    }
+    if (numFrames == 0)
+    {
+        std::cerr << "Replay \"" << path << "\" holds no frames" << std::endl;
+        return false;
+    }
+
+    // Nothing is owned until the first keyframe is applied
+    size_t numChunks = (size_t) header.numChunksX * header.numChunksY;
+    ownership.assign(numChunks * header.numTeams, 0);
+    ownedChunks.assign(header.numTeams, 0);
+
+    numOverlayTiles = {(header.numChunksX + OVERLAY_TILE_CHUNKS - 1) / OVERLAY_TILE_CHUNKS,
+                       (header.numChunksY + OVERLAY_TILE_CHUNKS - 1) / OVERLAY_TILE_CHUNKS};
+    overlayTiles.assign(numOverlayTiles.x * numOverlayTiles.y, WorldFrame::OverlayTile());
+    for (int y = 0; y < numOverlayTiles.y; y++)
+    {
+        for (int x = 0; x < numOverlayTiles.x; x++)
+        {
+            auto& tile = overlayTiles[x + y * numOverlayTiles.x];
+            tile.size = {std::min(OVERLAY_TILE_CHUNKS, header.numChunksX - x * OVERLAY_TILE_CHUNKS),
+                         std::min(OVERLAY_TILE_CHUNKS, header.numChunksY - y * OVERLAY_TILE_CHUNKS)};
+            tile.pixels.resize(tile.size.x * tile.size.y * 4);
+            for (size_t i = 0; i < tile.pixels.size(); i += 4)
+                tile.pixels[i + 3] = 127;
+            tile.version = 1;
+        }
+    }
+
+    return seek(0);
+}
+
+bool ReplayPlayer::loadSegment(int index)
+{
+    TRACE_SCOPE("loadReplaySegment");
+    auto& segment = segments[index];
+
+    compressed.resize(segment.header.compressedSize);
+    file.clear();
+    file.seekg(segment.offset);
+    if (!file.read((char*) compressed.data(), (std::streamsize) compressed.size()))
+    {
+        std::cerr << "Failed to read replay \"" << path << "\"" << std::endl;
+        return false;
+    }
+
+    raw.resize(segment.header.rawSize);
+    uLongf rawSize = segment.header.rawSize;
+    if (uncompress(raw.data(), &rawSize, compressed.data(), (uLong) compressed.size()) != Z_OK ||
+        rawSize != segment.header.rawSize)
+    {
+        std::cerr << "Replay \"" << path << "\" is corrupt" << std::endl;
+        return false;
+    }
+
+    decoding.frames.clear();
+    decoding.cellPositions.clear();
+    decoding.cellColors.clear();
+    decoding.teamCellCounts.clear();
+    decoding.changeChunks.clear();
+    decoding.changeBytes.clear();
+    decodedCells.clear();
+    decodedOwnership.assign(ownership.size(), 0);
+
+    const unsigned char* in = raw.data();
+    const unsigned char* end = in + raw.size();
+    for (uint32_t frame = 0; frame < segment.header.numFrames; frame++)
+    {
+        if (!decodeFrame(in, end, frame, segment.header.handleCapacity))
+        {
+            std::cerr << "Replay \"" << path << "\" is corrupt" << std::endl;
+            return false;
+        }
+    }
+
+    std::swap(loaded, decoding);
+    return true;
+}
+
+bool ReplayPlayer::decodeFrame(const unsigned char*& in, const unsigned char* end, uint32_t frame,
+                               uint32_t handleCapacity)
+{
+    int numTeams = header.numTeams;
+    bool keyframe = frame == 0;
+
+    if (end - in < 4) return false;
+    uint32_t timeBits = 0;
+    for (int i = 0; i < 4; i++)
+        timeBits |= (uint32_t) *in++ << (i * 8);
+
+    Frame decoded{};
+    std::memcpy(&decoded.worldTime, &timeBits, sizeof(timeBits));
+    decoded.firstCell = decoding.cellPositions.size();
+    decoded.firstChange = decoding.changeChunks.size();
+
+    decoding.teamCellCounts.resize(decoding.teamCellCounts.size() + numTeams, 0);
+    int* cellCounts = &decoding.teamCellCounts[frame * numTeams];
+
+    uint64_t numCells;
+    if (!readVarint(in, end, numCells)) return false;
+    uint64_t handle = (uint64_t) -1;
+    for (uint64_t i = 0; i < numCells; i++)
+    {
+        uint64_t value;
+        if (!readVarint(in, end, value)) return false;
+        bool isNew = keyframe || (value & 1);
+        handle += (keyframe ? value : value >> 1) + 1;
+        if (handle >= handleCapacity) return false;
+        if (handle >= decodedCells.size()) decodedCells.resize(handle + 1, DecodedCell());
+
+        auto& cell = decodedCells[handle];
+        if (isNew)
+        {
+            uint64_t team, x, y;
+            if (!readVarint(in, end, team) || !readVarint(in, end, x) || !readVarint(in, end, y) || in == end)
+                return false;
+            if (team >= (uint64_t) numTeams) return false;
+            cell.team = (uint8_t) team;
+            cell.x = (int32_t) zigzagDecode(x);
+            cell.y = (int32_t) zigzagDecode(y);
+            cell.health = *in++;
+        }
+        else
+        {
+            // Deltas are from the frame before, which must have held the cell
+            uint64_t dx, dy, dHealth;
+            if (cell.frame != frame || !readVarint(in, end, dx) || !readVarint(in, end, dy) ||
+                !readVarint(in, end, dHealth))
+                return false;
+            cell.x += (int32_t) zigzagDecode(dx);
+            cell.y += (int32_t) zigzagDecode(dy);
+            cell.health += (uint8_t) zigzagDecode(dHealth);
+        }
+        cell.frame = frame + 1;
+
+        auto color = teamColors[cell.team];
+        color.a = (uint8_t) lerp(150.f, 255.f, (float) cell.health / 255.f);
+        decoding.cellPositions.emplace_back((float) cell.x / (float) header.positionScale,
+                                            (float) cell.y / (float) header.positionScale);
+        decoding.cellColors.push_back(color);
+        cellCounts[cell.team]++;
+    }
+    decoded.numCells = decoding.cellPositions.size() - decoded.firstCell;
+
+    uint64_t numChanges;
+    if (!readVarint(in, end, numChanges)) return false;
+    uint64_t chunk = (uint64_t) -1;
+    for (uint64_t i = 0; i < numChanges; i++)
+    {
+        uint64_t gap;
+        if (!readVarint(in, end, gap)) return false;
+        chunk += gap + 1;
+        if (chunk >= ownership.size() / numTeams || end - in < numTeams) return false;
+
+        // Kept with the ownership it replaces, so the frame can be reverted
+        uint8_t* last = &decodedOwnership[chunk * numTeams];
+        decoding.changeChunks.push_back((int) chunk);
+        decoding.changeBytes.insert(decoding.changeBytes.end(), in, in + numTeams);
+        decoding.changeBytes.insert(decoding.changeBytes.end(), last, last + numTeams);
+        std::copy_n(in, numTeams, last);
+        in += numTeams;
+    }
+    decoded.numChanges = decoding.changeChunks.size() - decoded.firstChange;
+
+    decoding.frames.push_back(decoded);
+    return true;
+}
+
+void ReplayPlayer::applyKeyframe()
+{
+    int numTeams = header.numTeams;
+    const std::vector<uint8_t> unowned(numTeams, 0);
+
+    // The keyframe lists owned chunks in order, every other chunk is unowned
+    auto& keyframe = loaded.frames[0];
+    size_t change = keyframe.firstChange;
+    size_t end = keyframe.firstChange + keyframe.numChanges;
+    int numChunks = (int) (ownership.size() / numTeams);
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        if (change < end && loaded.changeChunks[change] == chunk)
+        {
+            setOwnership(chunk, &loaded.changeBytes[change * 2 * numTeams]);
+            change++;
+        }
+        else
+            setOwnership(chunk, unowned.data());
+    }
+}
+
+void ReplayPlayer::setOwnership(int chunk, const uint8_t* teamOwnership)
+{
+    int numTeams = header.numTeams;
+    uint8_t* current = &ownership[(size_t) chunk * numTeams];
+    if (std::memcmp(current, teamOwnership, numTeams) == 0) return;
+
+    sf::Vector3f colorVec;
+    for (int i = 0; i < numTeams; i++)
+    {
+        ownedChunks[i] += (teamOwnership[i] == 255) - (current[i] == 255);
+        current[i] = teamOwnership[i];
+
+        // As World::updateTerritoryColor
+        float teamShare = (float) teamOwnership[i] / 255.f;
+        colorVec.x += (float) teamColors[i].r * teamShare;
+        colorVec.y += (float) teamColors[i].g * teamShare;
+        colorVec.z += (float) teamColors[i].b * teamShare;
+    }
+
+    int x = chunk % header.numChunksX;
+    int y = chunk / header.numChunksX;
+    auto& tile = overlayTiles[x / OVERLAY_TILE_CHUNKS + y / OVERLAY_TILE_CHUNKS * numOverlayTiles.x];
+    sf::Uint8* pixel = &tile.pixels[(x % OVERLAY_TILE_CHUNKS + y % OVERLAY_TILE_CHUNKS * tile.size.x) * 4];
+    sf::Uint8 color[3] = {(sf::Uint8) colorVec.x, (sf::Uint8) colorVec.y, (sf::Uint8) colorVec.z};
+    if (std::memcmp(pixel, color, 3) == 0) return;
+
+    std::copy_n(color, 3, pixel);
+    tile.version++;
+}
+
+void ReplayPlayer::applyChanges(uint32_t from, uint32_t to)
+{
+    int numTeams = header.numTeams;
+    for (; from < to; from++)
+    {
+        auto& frame = loaded.frames[from + 1];
+        for (size_t i = frame.firstChange; i < frame.firstChange + frame.numChanges; i++)
+            setOwnership(loaded.changeChunks[i], &loaded.changeBytes[i * 2 * numTeams]);
+    }
+    for (; from > to; from--)
+    {
+        auto& frame = loaded.frames[from];
+        for (size_t i = frame.firstChange + frame.numChanges; i-- > frame.firstChange;)
+            setOwnership(loaded.changeChunks[i], &loaded.changeBytes[i * 2 * numTeams + numTeams]);
+    }
+}
+
+uint32_t ReplayPlayer::getNumFrames() const
+{
+    return numFrames;
+}
+
+uint32_t ReplayPlayer::getFrame() const
+{
+    return currentFrame;
+}
+
+float ReplayPlayer::getWorldTime() const
+{
+    if (loadedSegment == -1) return 0;
+    return loaded.frames[currentFrame - segments[loadedSegment].header.firstFrame].worldTime;
+}
+
+std::vector<TeamStats> ReplayPlayer::getTeamStats() const
+{
+    std::vector<TeamStats> stats(header.numTeams);
+    if (loadedSegment == -1) return stats;
+
+    uint32_t localFrame = currentFrame - segments[loadedSegment].header.firstFrame;
+    for (int i = 0; i < header.numTeams; i++)
+    {
+        stats[i].cellCount = loaded.teamCellCounts[localFrame * header.numTeams + i];
+        stats[i].ownedChunks = ownedChunks[i];
+    }
+    return stats;
+}
+
+bool ReplayPlayer::seek(int64_t frame)
+{
+    if (segments.empty()) return false;
+    uint32_t target = (uint32_t) clamp<int64_t>(frame, 0, numFrames - 1);
+
+    // Last segment starting at or before target
+    auto segment = std::upper_bound(segments.begin(), segments.end(), target,
+                                    [](uint32_t frame, const Segment& segment)
+                                    { return frame < segment.header.firstFrame; }) - 1;
+    int index = (int) (segment - segments.begin());
+    uint32_t firstFrame = segment->header.firstFrame;
+
+    if (index != loadedSegment)
+    {
+        if (!loadSegment(index)) return false;
+        loadedSegment = index;
+        applyKeyframe();
+        currentFrame = firstFrame;
+    }
+
+    applyChanges(currentFrame - firstFrame, target - firstFrame);
+    currentFrame = target;
+    return true;
+}
+
+void ReplayPlayer::captureFrame(WorldFrame& frame, sf::FloatRect area) const
+{
+    TRACE_SCOPE("captureReplayFrame");
+    frame.size = {(float) header.width, (float) header.height};
+    frame.numChunks = {header.numChunksX, header.numChunksY};
+    frame.pixelsPerChunk = header.pixelsPerChunk;
+    frame.cellRadius = header.cellRadius;
+    frame.area = area;
+    frame.worldTime = getWorldTime();
+    frame.numOverlayTiles = numOverlayTiles;
+    frame.overlayTiles.resize(overlayTiles.size());
+    frame.cellPositions.clear();
+    frame.cellColors.clear();
+
+    frame.teamStats = getTeamStats();
+    frame.firstTile = {0, 0};
+    frame.lastTile = {-1, -1};
+    if (loadedSegment == -1) return;
+    uint32_t localFrame = currentFrame - segments[loadedSegment].header.firstFrame;
+
+    if (!area.intersects(sf::FloatRect({0, 0}, frame.size)))
+        return;
+
+    frame.firstTile = getClampedChunkPos({area.left, area.top}, frame.pixelsPerChunk, frame.numChunks) /
+                      OVERLAY_TILE_CHUNKS;
+    frame.lastTile = getClampedChunkPos({area.left + area.width, area.top + area.height}, frame.pixelsPerChunk,
+                                        frame.numChunks) / OVERLAY_TILE_CHUNKS;
+    for (int y = frame.firstTile.y; y <= frame.lastTile.y; y++)
+    {
+        for (int x = frame.firstTile.x; x <= frame.lastTile.x; x++)
+        {
+            auto& tile = overlayTiles[x + y * numOverlayTiles.x];
+            auto& frameTile = frame.overlayTiles[x + y * numOverlayTiles.x];
+            if (frameTile.version == tile.version) continue;
+            frameTile = tile;
+        }
+    }
+
+    area = getCellCullArea(area, header.cellRadius);
+    auto& decoded = loaded.frames[localFrame];
+    for (size_t i = decoded.firstCell; i < decoded.firstCell + decoded.numCells; i++)
+    {
+        if (!area.contains(loaded.cellPositions[i])) continue;
+        frame.cellPositions.push_back(loaded.cellPositions[i]);
+        frame.cellColors.push_back(loaded.cellColors[i]);
+    }
+    TRACE_COUNTER("cells", frame.cellPositions.size());
+}
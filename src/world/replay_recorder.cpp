@@ -0,0 +1,251 @@
+#include "world/replay_recorder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+#include "utils.h"
+#include "world/replay.h"
+#include "world/trace.h"
+#include "world/world.h"
+
+// 0 and 255 are kept for exactly none and all of it, so ownership bytes tell full and claimed chunks apart like the
+// world does
+static uint8_t quantizeFraction(float value)
+{
+    if (value <= 0.f) return 0;
+    if (value >= 1.f) return 255;
+    return (uint8_t) clamp<long>(std::lround(value * 255.f), 1, 254);
+}
+
+ReplayRecorder::~ReplayRecorder()
+{
+    close();
+}
+
+bool ReplayRecorder::open(const std::string& path, const World& world, int keyframeInterval)
+{
+    close();
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to open replay \"" << path << "\" for writing" << std::endl;
+        return false;
+    }
+
+    auto& settings = world.settings;
+    this->path = path;
+    this->keyframeInterval = std::max(1, keyframeInterval);
+    numTeams = settings.numTeams;
+    numChunksX = settings.numChunks.x;
+    numFrames = 0;
+    segmentFrames = 0;
+    segment.clear();
+    cells.clear();
+    currentCells.clear();
+    ownership.assign((size_t) settings.numChunks.x * settings.numChunks.y * numTeams, 0);
+
+    ReplayHeader header{};
+    std::memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.byteOrder = REPLAY_BYTE_ORDER;
+    header.width = settings.width;
+    header.height = settings.height;
+    header.numChunksX = settings.numChunks.x;
+    header.numChunksY = settings.numChunks.y;
+    header.pixelsPerChunk = (float) settings.pixelsPerChunk;
+    header.cellRadius = settings.cellRadius;
+    header.numTeams = numTeams;
+    header.positionScale = POSITION_SCALE;
+    header.keyframeInterval = this->keyframeInterval;
+
+    std::vector<unsigned char> colors;
+    for (int i = 0; i < numTeams; i++)
+    {
+        auto color = settings.teamColors[i];
+        colors.insert(colors.end(), {color.r, color.g, color.b, color.a});
+    }
+
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1 ||
+        std::fwrite(colors.data(), 1, colors.size(), file) != colors.size())
+    {
+        std::cerr << "Failed to write replay \"" << path << "\"" << std::endl;
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool ReplayRecorder::record(const World& world)
+{
+    if (file == nullptr) return false;
+
+    TRACE_SCOPE("recordReplay");
+    bool keyframe = segmentFrames == 0;
+
+    uint32_t timeBits;
+    std::memcpy(&timeBits, &world.worldTime, sizeof(timeBits));
+    for (int i = 0; i < 4; i++)
+        segment.push_back((unsigned char) (timeBits >> (i * 8)));
+
+    recordCells(world, keyframe);
+    recordChunks(world, keyframe);
+
+    numFrames++;
+    segmentFrames++;
+    if (segmentFrames == (uint32_t) keyframeInterval) return writeSegment();
+    return true;
+}
+
+void ReplayRecorder::recordCells(const World& world, bool keyframe)
+{
+    auto& store = world.cells;
+    uint32_t frame = numFrames + 1;
+
+    // Gathered by handle first, so they can be written in handle order
+    for (size_t i = 0; i < store.size(); i++)
+    {
+        CellHandle handle = store.handle[i];
+        if (handle >= currentCells.size())
+        {
+            currentCells.resize(handle + 1, RecordedCell());
+            cells.resize(handle + 1, RecordedCell());
+        }
+
+        auto position = store.position[i];
+        currentCells[handle] = {(int32_t) std::lround(position.x * POSITION_SCALE),
+                                (int32_t) std::lround(position.y * POSITION_SCALE),
+                                (uint8_t) store.teamId[i], quantizeFraction(store.health[i]), frame};
+    }
+
+    writeVarint(segment, store.size());
+    int64_t lastHandle = -1;
+    for (size_t handle = 0; handle < currentCells.size(); handle++)
+    {
+        auto& cell = currentCells[handle];
+        if (cell.frame != frame) continue;
+
+        // A handle freed and taken by another cell between frames may change team
+        auto& last = cells[handle];
+        bool isNew = keyframe || last.frame != frame - 1 || last.team != cell.team;
+
+        uint64_t gap = (uint64_t) ((int64_t) handle - lastHandle - 1);
+        writeVarint(segment, keyframe ? gap : gap << 1 | (isNew ? 1 : 0));
+        if (isNew)
+        {
+            writeVarint(segment, cell.team);
+            writeVarint(segment, zigzagEncode(cell.x));
+            writeVarint(segment, zigzagEncode(cell.y));
+            segment.push_back(cell.health);
+        }
+        else
+        {
+            writeVarint(segment, zigzagEncode(cell.x - last.x));
+            writeVarint(segment, zigzagEncode(cell.y - last.y));
+            writeVarint(segment, zigzagEncode(cell.health - last.health));
+        }
+
+        last = cell;
+        lastHandle = (int64_t) handle;
+    }
+}
+
+void ReplayRecorder::recordChunks(const World& world, bool keyframe)
+{
+    auto& settings = world.settings;
+
+    // Keyframes look at every chunk, other frames only at those the last step changed the ownership of
+    changedChunks.clear();
+    if (keyframe)
+    {
+        for (int i = 0; i < settings.numChunks.x * settings.numChunks.y; i++)
+            changedChunks.push_back(i);
+    }
+    else
+    {
+        for (auto& update: world.ownershipUpdates)
+        {
+            sf::Vector2i pos = world.getChunkPos(update.index);
+            changedChunks.push_back(pos.x + pos.y * numChunksX);
+        }
+        std::sort(changedChunks.begin(), changedChunks.end());
+        changedChunks.erase(std::unique(changedChunks.begin(), changedChunks.end()), changedChunks.end());
+    }
+
+    // Kept to those written, with their new ownership
+    size_t numWritten = 0;
+    chunkOwnership.resize(changedChunks.size() * numTeams);
+    for (int chunk: changedChunks)
+    {
+        int index = world.getChunkIndex({chunk % numChunksX, chunk / numChunksX});
+        const float* teamOwnership = &world.getTile(index).ownership[index % CHUNK_TILE_AREA * numTeams];
+
+        uint8_t* quantized = &chunkOwnership[numWritten * numTeams];
+        bool owned = false;
+        for (int team = 0; team < numTeams; team++)
+        {
+            quantized[team] = quantizeFraction(teamOwnership[team]);
+            owned |= quantized[team] != 0;
+        }
+
+        uint8_t* last = &ownership[(size_t) chunk * numTeams];
+        bool changed = !std::equal(quantized, quantized + numTeams, last);
+        std::copy_n(quantized, numTeams, last);
+        if (keyframe ? owned : changed) changedChunks[numWritten++] = chunk;
+    }
+
+    writeVarint(segment, numWritten);
+    int lastChunk = -1;
+    for (size_t i = 0; i < numWritten; i++)
+    {
+        writeVarint(segment, (uint64_t) (changedChunks[i] - lastChunk - 1));
+        segment.insert(segment.end(), &chunkOwnership[i * numTeams], &chunkOwnership[(i + 1) * numTeams]);
+        lastChunk = changedChunks[i];
+    }
+}
+
+bool ReplayRecorder::writeSegment()
+{
+    if (segmentFrames == 0) return true;
+
+    TRACE_SCOPE("writeReplaySegment");
+    uLongf compressedSize = compressBound((uLong) segment.size());
+    compressed.resize(compressedSize);
+    bool written = compress(compressed.data(), &compressedSize, segment.data(), (uLong) segment.size()) == Z_OK;
+
+    ReplaySegmentHeader header{};
+    header.compressedSize = (uint32_t) compressedSize;
+    header.rawSize = (uint32_t) segment.size();
+    header.firstFrame = numFrames - segmentFrames;
+    header.numFrames = segmentFrames;
+    header.handleCapacity = (uint32_t) currentCells.size();
+
+    written = written && std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(compressed.data(), 1, compressedSize, file) == compressedSize;
+    segment.clear();
+    segmentFrames = 0;
+
+    if (!written)
+    {
+        std::cerr << "Failed to write replay \"" << path << "\"" << std::endl;
+        std::fclose(file);
+        file = nullptr;
+    }
+    return written;
+}
+
+bool ReplayRecorder::close()
+{
+    if (file == nullptr) return true;
+
+    bool written = writeSegment();
+    if (file != nullptr && std::fclose(file) != 0)
+    {
+        std::cerr << "Failed to write replay \"" << path << "\"" << std::endl;
+        written = false;
+    }
+    file = nullptr;
+    return written;
+}
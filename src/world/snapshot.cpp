@@ -0,0 +1,327 @@
+#include "world/world.h"
+#include "world/snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "utils.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SNAPSHOT_ALIGNMENT 16
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+static const char SNAPSHOT_MAGIC[8] = {'C', 'B', 'S', 'N', 'A', 'P', '\0', '\0'};
+
+static_assert(sizeof(int) == sizeof(int32_t), "Snapshots store int fields as 32 bit integers");
+
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// Read only view of a whole file. Mapped where supported, read into memory otherwise.
+class FileView
+{
+    std::vector<unsigned char> buffer;
+    const unsigned char* mapping = nullptr;
+
+public:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    FileView() = default;
+
+    FileView(const FileView&) = delete;
+
+    ~FileView()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapping != nullptr) munmap((void*) mapping, size);
+#endif
+    }
+
+    bool open(const std::string& path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info{};
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void* mapped = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                mapping = (const unsigned char*) mapped;
+                data = mapping;
+                size = (size_t) info.st_size;
+            }
+        }
+        close(fd);
+        if (mapping != nullptr) return true;
+#endif
+
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) return false;
+
+        unsigned char chunk[1 << 16];
+        size_t read;
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            buffer.insert(buffer.end(), chunk, chunk + read);
+        bool failed = std::ferror(file) != 0;
+        std::fclose(file);
+
+        data = buffer.data();
+        size = buffer.size();
+        return !failed;
+    }
+};
+
+bool World::saveSnapshot(const std::string& path) const
+{
+    // Chunk sections are in row order, gathered from the tiles
+    size_t numChunks = (size_t) settings.numChunks.x * settings.numChunks.y;
+    std::vector<float> ownership(numChunks * settings.numTeams);
+    std::vector<float> supply(numChunks);
+    std::vector<float> supplyGeneration(numChunks);
+    std::vector<float> development(numChunks);
+    for (int y = 0; y < settings.numChunks.y; y++)
+    {
+        for (int x = 0; x < settings.numChunks.x; x++)
+        {
+            size_t i = x + (size_t) y * settings.numChunks.x;
+            int index = getChunkIndex({x, y});
+            auto& tile = getTile(index);
+            int local = index % CHUNK_TILE_AREA;
+
+            std::copy_n(&tile.ownership[local * settings.numTeams], settings.numTeams,
+                        ownership.begin() + (ptrdiff_t) (i * settings.numTeams));
+            supply[i] = tile.supply[local];
+            supplyGeneration[i] = chunkSupplyGeneration[index];
+            development[i] = tile.development[local];
+        }
+    }
+
+    struct Section
+    {
+        const void* data;
+        uint64_t size;
+    };
+
+    // In SnapshotSection order
+    const Section sections[NUM_SNAPSHOT_SECTIONS] = {
+            {ownership.data(),               ownership.size() * sizeof(float)},
+            {supply.data(),                  supply.size() * sizeof(float)},
+            {supplyGeneration.data(),        supplyGeneration.size() * sizeof(float)},
+            {development.data(),             development.size() * sizeof(float)},
+            {cells.teamId.data(),            cells.size() * sizeof(int)},
+            {cells.seed.data(),              cells.size() * sizeof(int)},
+            {cells.attack.data(),            cells.size() * sizeof(float)},
+            {cells.defense.data(),           cells.size() * sizeof(float)},
+            {cells.speed.data(),             cells.size() * sizeof(float)},
+            {cells.metabolism.data(),        cells.size() * sizeof(float)},
+            {cells.health.data(),            cells.size() * sizeof(float)},
+            {cells.supply.data(),            cells.size() * sizeof(float)},
+            {cells.childProgress.data(),     cells.size() * sizeof(float)},
+            {cells.numChildren.data(),       cells.size() * sizeof(int)},
+            {cells.velocity.data(),          cells.size() * sizeof(sf::Vector2f)},
+            {cells.preferredVelocity.data(), cells.size() * sizeof(sf::Vector2f)},
+            {cells.position.data(),          cells.size() * sizeof(sf::Vector2f)},
+    };
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.numChunksX = settings.numChunks.x;
+    header.numChunksY = settings.numChunks.y;
+    header.numTeams = settings.numTeams;
+    header.worldTime = worldTime;
+    header.seed = seed;
+    header.maxSupplyGeneration = maxSupplyGeneration;
+    header.numCells = cells.size();
+
+    uint64_t offset = alignOffset(sizeof(header));
+    for (int i = 0; i < NUM_SNAPSHOT_SECTIONS; i++)
+    {
+        header.sectionOffsets[i] = offset;
+        header.sectionSizes[i] = sections[i].size;
+        offset = alignOffset(offset + sections[i].size);
+    }
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to open snapshot \"" << path << "\" for writing" << std::endl;
+        return false;
+    }
+
+    static const char zeros[SNAPSHOT_ALIGNMENT] = {};
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(header);
+    for (int i = 0; i < NUM_SNAPSHOT_SECTIONS && written; i++)
+    {
+        uint64_t padding = header.sectionOffsets[i] - position;
+        written = std::fwrite(zeros, 1, padding, file) == padding;
+        if (sections[i].size > 0)
+            written = written && std::fwrite(sections[i].data, 1, sections[i].size, file) == sections[i].size;
+        position = header.sectionOffsets[i] + sections[i].size;
+    }
+
+    written = std::fclose(file) == 0 && written;
+    if (!written)
+        std::cerr << "Failed to write snapshot \"" << path << "\"" << std::endl;
+    return written;
+}
+
+bool World::loadSnapshot(const std::string& path)
+{
+    FileView file;
+    if (!file.open(path))
+    {
+        std::cerr << "Failed to open snapshot \"" << path << "\"" << std::endl;
+        return false;
+    }
+
+    SnapshotHeader header{};
+    if (file.size < sizeof(header))
+    {
+        std::cerr << "Failed to load snapshot \"" << path << "\". File is truncated" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, file.data, sizeof(header));
+
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.byteOrder != SNAPSHOT_BYTE_ORDER)
+    {
+        std::cerr << "Failed to load snapshot \"" << path << "\". Not a version " << SNAPSHOT_VERSION
+                  << " snapshot in this machine's byte order" << std::endl;
+        return false;
+    }
+
+    if (header.numChunksX != settings.numChunks.x || header.numChunksY != settings.numChunks.y ||
+        header.numTeams != settings.numTeams)
+    {
+        std::cerr << "Failed to load snapshot \"" << path << "\". It was saved with a " << header.numChunksX << "x"
+                  << header.numChunksY << " chunk grid and " << header.numTeams << " teams" << std::endl;
+        return false;
+    }
+
+    uint64_t numCells = header.numCells;
+    if (numCells > file.size)
+    {
+        std::cerr << "Failed to load snapshot \"" << path << "\". File is truncated" << std::endl;
+        return false;
+    }
+
+    size_t numChunks = (size_t) settings.numChunks.x * settings.numChunks.y;
+    uint64_t chunkBytes = numChunks * sizeof(float);
+    uint64_t expectedSizes[NUM_SNAPSHOT_SECTIONS] = {
+            chunkBytes * settings.numTeams, chunkBytes, chunkBytes, chunkBytes,
+            numCells * sizeof(int), numCells * sizeof(int),
+            numCells * sizeof(float), numCells * sizeof(float), numCells * sizeof(float), numCells * sizeof(float),
+            numCells * sizeof(float), numCells * sizeof(float), numCells * sizeof(float),
+            numCells * sizeof(int),
+            numCells * sizeof(sf::Vector2f), numCells * sizeof(sf::Vector2f), numCells * sizeof(sf::Vector2f),
+    };
+
+    for (int i = 0; i < NUM_SNAPSHOT_SECTIONS; i++)
+    {
+        if (header.sectionSizes[i] != expectedSizes[i] || header.sectionOffsets[i] > file.size ||
+            header.sectionSizes[i] > file.size - header.sectionOffsets[i])
+        {
+            std::cerr << "Failed to load snapshot \"" << path << "\". Section " << i << " is corrupt" << std::endl;
+            return false;
+        }
+    }
+
+    auto section = [&](SnapshotSection s) { return file.data + header.sectionOffsets[s]; };
+    auto copySection = [&](SnapshotSection s, void* destination)
+    {
+        if (header.sectionSizes[s] > 0)
+            std::memcpy(destination, section(s), header.sectionSizes[s]);
+    };
+
+    // Cells index chunks by team and position, so check those before touching the world
+    for (uint64_t i = 0; i < numCells; i++)
+    {
+        int32_t teamId;
+        sf::Vector2f position;
+        std::memcpy(&teamId, section(SNAPSHOT_TEAM_ID) + i * sizeof(int32_t), sizeof(teamId));
+        std::memcpy(&position, section(SNAPSHOT_POSITION) + i * sizeof(sf::Vector2f), sizeof(position));
+
+        if (teamId < 0 || teamId >= settings.numTeams ||
+            !inBoundsEx(worldToChunkPos(position), {0, 0}, settings.numChunks))
+        {
+            std::cerr << "Failed to load snapshot \"" << path << "\". Cell " << i << " is corrupt" << std::endl;
+            return false;
+        }
+    }
+
+    seed = header.seed;
+    worldTime = header.worldTime;
+    maxSupplyGeneration = header.maxSupplyGeneration;
+
+    cells.reset(numCells);
+    copySection(SNAPSHOT_TEAM_ID, cells.teamId.data());
+    copySection(SNAPSHOT_SEED, cells.seed.data());
+    copySection(SNAPSHOT_ATTACK, cells.attack.data());
+    copySection(SNAPSHOT_DEFENSE, cells.defense.data());
+    copySection(SNAPSHOT_SPEED, cells.speed.data());
+    copySection(SNAPSHOT_METABOLISM, cells.metabolism.data());
+    copySection(SNAPSHOT_HEALTH, cells.health.data());
+    copySection(SNAPSHOT_CELL_SUPPLY, cells.supply.data());
+    copySection(SNAPSHOT_CHILD_PROGRESS, cells.childProgress.data());
+    copySection(SNAPSHOT_NUM_CHILDREN, cells.numChildren.data());
+    copySection(SNAPSHOT_VELOCITY, cells.velocity.data());
+    copySection(SNAPSHOT_PREFERRED_VELOCITY, cells.preferredVelocity.data());
+    copySection(SNAPSHOT_POSITION, cells.position.data());
+
+    // Start over from empty tiles. Chunks only allocate a tile if they differ from an untouched one.
+    clearChunks();
+    std::fill(teamTotals.begin(), teamTotals.end(), TeamTotals());
+
+    std::vector<float> chunkValues(numChunks * settings.numTeams);
+    auto forEachChunk = [&](auto f)
+    {
+        for (int y = 0; y < settings.numChunks.y; y++)
+            for (int x = 0; x < settings.numChunks.x; x++)
+                f(x + (size_t) y * settings.numChunks.x, getChunkIndex({x, y}));
+    };
+
+    copySection(SNAPSHOT_SUPPLY_GENERATION, chunkValues.data());
+    forEachChunk([&](size_t i, int index) { chunkSupplyGeneration[index] = chunkValues[i]; });
+
+    copySection(SNAPSHOT_SUPPLY, chunkValues.data());
+    forEachChunk([&](size_t i, int index)
+    {
+        if (chunkValues[i] != 0.f) allocateTile(index).supply[index % CHUNK_TILE_AREA] = chunkValues[i];
+    });
+
+    copySection(SNAPSHOT_DEVELOPMENT, chunkValues.data());
+    forEachChunk([&](size_t i, int index)
+    {
+        if (chunkValues[i] != 0.f) allocateTile(index).development[index % CHUNK_TILE_AREA] = chunkValues[i];
+    });
+
+    // Everything else is derived. Ownership goes through setOwnership to rebuild the owner and mask caches.
+    copySection(SNAPSHOT_OWNERSHIP, chunkValues.data());
+    forEachChunk([&](size_t i, int index)
+    {
+        for (int team = 0; team < settings.numTeams; team++)
+            setOwnership(index, team, chunkValues[i * settings.numTeams + team]);
+    });
+
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        insertIntoChunk((uint32_t) i, worldToChunkPos(cells.position[i]));
+        updateTeamTotals((uint32_t) i, 1);
+    }
+
+    return true;
+}
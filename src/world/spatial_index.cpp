@@ -0,0 +1,144 @@
+#include "world/spatial_index.h"
+#include <cmath>
+#include "utils.h"
+
+#define RADIX_BITS 11
+
+void SpatialIndex::resize(sf::Vector2f worldSize, float bucketSize, int numTeams)
+{
+    this->bucketSize = bucketSize;
+    this->numTeams = numTeams;
+    numBuckets.x = std::max(1, (int) ceilf(worldSize.x / bucketSize));
+    numBuckets.y = std::max(1, (int) ceilf(worldSize.y / bucketSize));
+    histogram.resize(1 << RADIX_BITS);
+}
+
+sf::Vector2i SpatialIndex::getBucket(sf::Vector2f position) const
+{
+    sf::Vector2i bucket = {(int) (position.x / bucketSize), (int) (position.y / bucketSize)};
+    return clamp(bucket, {0, 0}, numBuckets - sf::Vector2i(1, 1));
+}
+
+void SpatialIndex::rebuild(const CellStore& cells)
+{
+    keys.clear();
+    cellIndices.clear();
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        if (cells.health[i] <= 0) continue;
+        keys.push_back(getKey(getBucket(cells.position[i]), cells.teamId[i]));
+        cellIndices.push_back((uint32_t) i);
+    }
+
+    size_t n = keys.size();
+    keyScratch.resize(n);
+    indexScratch.resize(n);
+
+    // LSD radix sort. It is stable, so cells sharing a key stay in cell order and queries are deterministic.
+    uint64_t maxKey = getKey(numBuckets - sf::Vector2i(1, 1), numTeams - 1);
+    for (int shift = 0; shift < 64 && (maxKey >> shift) != 0; shift += RADIX_BITS)
+    {
+        std::fill(histogram.begin(), histogram.end(), 0);
+        for (size_t i = 0; i < n; i++)
+            histogram[(keys[i] >> shift) & ((1 << RADIX_BITS) - 1)]++;
+
+        uint32_t offset = 0;
+        for (auto& count: histogram)
+        {
+            uint32_t c = count;
+            count = offset;
+            offset += c;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t dest = histogram[(keys[i] >> shift) & ((1 << RADIX_BITS) - 1)]++;
+            keyScratch[dest] = keys[i];
+            indexScratch[dest] = cellIndices[i];
+        }
+        keys.swap(keyScratch);
+        cellIndices.swap(indexScratch);
+    }
+
+    positions.resize(n);
+    for (size_t i = 0; i < n; i++)
+        positions[i] = cells.position[cellIndices[i]];
+}
+
+int SpatialIndex::getNeighborRanges(sf::Vector2i center, Range* ranges) const
+{
+    // Center first, so the early exit prunes the most neighbors
+    static const sf::Vector2i offsets[9] = {{0,  0}, {-1, -1}, {0, -1}, {1, -1}, {-1, 0},
+                                            {1,  0}, {-1, 1}, {0,  1}, {1,  1}};
+
+    int numRanges = 0;
+    for (auto offset: offsets)
+    {
+        sf::Vector2i bucket = center + offset;
+        if (!inBoundsEx(bucket, {0, 0}, numBuckets)) continue;
+
+        uint64_t firstKey = getKey(bucket, 0);
+        size_t begin = lowerBound(0, keys.size(), firstKey);
+        size_t end = lowerBound(begin, keys.size(), firstKey + numTeams);
+        if (begin == end) continue;
+
+        sf::Vector2f min = sf::Vector2f(bucket) * bucketSize;
+        ranges[numRanges++] = {firstKey / numTeams, begin, end, min, min + sf::Vector2f(bucketSize, bucketSize)};
+    }
+    return numRanges;
+}
+
+float SpatialIndex::distanceSq(sf::Vector2f position, const Range& range)
+{
+    float dx = std::max(std::max(range.min.x - position.x, position.x - range.max.x), 0.f);
+    float dy = std::max(std::max(range.min.y - position.y, position.y - range.max.y), 0.f);
+    return dx * dx + dy * dy;
+}
+
+void SpatialIndex::scan(size_t begin, size_t end, sf::Vector2f position, float& bestDistSq, int& bestEntry) const
+{
+    for (size_t entry = begin; entry < end; entry++)
+    {
+        auto offset = positions[entry] - position;
+        float distSq = offset.x * offset.x + offset.y * offset.y;
+
+        if (distSq < bestDistSq)
+        {
+            bestDistSq = distSq;
+            bestEntry = (int) entry;
+        }
+    }
+}
+
+int SpatialIndex::findNearest(sf::Vector2f position, int teamId, bool enemies, float maxDistance, int exclude) const
+{
+    Range ranges[9];
+    int numRanges = getNeighborRanges(getBucket(position), ranges);
+
+    float bestDistSq = maxDistance * maxDistance;
+    int bestEntry = -1;
+
+    for (int r = 0; r < numRanges; r++)
+    {
+        if (distanceSq(position, ranges[r]) >= bestDistSq) continue;
+
+        uint64_t ownKey = ranges[r].bucketIndex * numTeams + teamId;
+        size_t ownBegin = lowerBound(ranges[r].begin, ranges[r].end, ownKey);
+        size_t ownEnd = lowerBound(ownBegin, ranges[r].end, ownKey + 1);
+
+        if (enemies)
+        {
+            scan(ranges[r].begin, ownBegin, position, bestDistSq, bestEntry);
+            scan(ownEnd, ranges[r].end, position, bestDistSq, bestEntry);
+            continue;
+        }
+
+        for (size_t entry = ownBegin; entry < ownEnd; entry++)
+        {
+            if ((int) cellIndices[entry] == exclude) continue;
+            scan(entry, entry + 1, position, bestDistSq, bestEntry);
+        }
+    }
+
+    return bestEntry == -1 ? -1 : (int) cellIndices[bestEntry];
+}
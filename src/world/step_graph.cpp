@@ -0,0 +1,91 @@
+#include "world/step_graph.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+const char* getStepResourceName(int resource)
+{
+    switch (1u << resource)
+    {
+        case CELL_POSITIONS: return "cell positions";
+        case CELL_MOTION: return "cell motion";
+        case CELL_SUPPLY: return "cell supply";
+        case CELL_HEALTH: return "cell health";
+        case CELL_STORE: return "cell store";
+        case CHUNK_CELLS: return "chunk cells";
+        case ACTIVE_CHUNKS: return "active chunks";
+        case CHUNK_TILES: return "chunk tiles";
+        case CHUNK_OWNERSHIP: return "chunk ownership";
+        case CHUNK_DEVELOPMENT: return "chunk development";
+        case CHUNK_SUPPLY: return "chunk supply";
+        case CHUNK_DEMAND: return "chunk demand";
+        default: return "unknown";
+    }
+}
+
+// Resources a and b can't both touch at once: either writes one the other reads or writes
+static uint32_t getConflicts(const StepGraph::Node& a, const StepGraph::Node& b)
+{
+    return (a.writes & (b.reads | b.writes)) | (b.writes & a.reads);
+}
+
+void StepGraph::add(const char* name, StepPhase phase, void (World::*run)(float), uint32_t reads, uint32_t writes)
+{
+    if (nodes.size() == MAX_NODES)
+    {
+        std::cerr << "Step graph can't hold more than " << MAX_NODES << " nodes" << std::endl;
+        std::abort();
+    }
+
+    Node node;
+    node.name = name;
+    node.phase = phase;
+    node.run = run;
+    node.reads = reads | writes;
+    node.writes = writes;
+    int index = (int) nodes.size();
+    for (int i = 0; i < index; i++)
+    {
+        if (getConflicts(nodes[i], node) == 0) continue;
+        nodes[i].successors.push_back(index);
+        node.numPredecessors++;
+    }
+
+    if (node.numPredecessors == 0) roots.push_back(index);
+    nodes.push_back(node);
+}
+
+void StepGraph::reset()
+{
+    for (size_t i = 0; i < nodes.size(); i++)
+        pending[i].store(nodes[i].numPredecessors, std::memory_order_relaxed);
+}
+
+bool StepGraph::finishPredecessor(int node)
+{
+    // Each predecessor's writes happen before the node runs on whichever thread counts the last one
+    return pending[node].fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
+
+void StepGraph::beginNode(int node)
+{
+    std::lock_guard<std::mutex> lock(runningMutex);
+    for (int other: running)
+    {
+        uint32_t conflicts = getConflicts(nodes[node], nodes[other]);
+        if (conflicts == 0) continue;
+
+        int resource = 0;
+        while (!(conflicts >> resource & 1)) resource++;
+        std::cerr << "Step nodes " << nodes[node].name << " and " << nodes[other].name << " ran at once, but both use "
+                  << getStepResourceName(resource) << std::endl;
+        std::abort();
+    }
+    running.push_back(node);
+}
+
+void StepGraph::endNode(int node)
+{
+    std::lock_guard<std::mutex> lock(runningMutex);
+    running.erase(std::find(running.begin(), running.end(), node));
+}
@@ -0,0 +1,17 @@
+#include "world/step_phase.h"
+
+const char* getStepPhaseName(StepPhase phase)
+{
+    switch (phase)
+    {
+        case UPDATE_TERRITORIES: return "updateTerritories";
+        case DEVELOP_CHUNKS: return "developChunks";
+        case UPDATE_CHUNK_SUPPLY: return "updateChunkSupply";
+        case UPDATE_CELL_SUPPLY: return "updateCellSupply";
+        case UPDATE_VELOCITIES: return "updateVelocities";
+        case UPDATE_POSITIONS: return "updatePositions";
+        case ATTACK_NEARBY: return "attackNearby";
+        case SPAWN_CHILDREN: return "spawnChildren";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,95 @@
+#include "world/supply_diffusion.h"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Reference kernel for a single chunk, used wherever SIMD is unavailable. supply and owner point at the chunk in
+// grids whose rows are stride apart; every neighbor is in the grid.
+static float diffuseChunk(const float* supply, const int* owner, int stride, float generation, float development,
+                          float diffusionRate, float delta)
+{
+    float cur = *supply;
+    int curOwner = *owner;
+
+    if (curOwner == -1)
+        return cur + std::max(10.f * -delta, -cur) * delta;
+
+    float eastSupply = owner[1] == curOwner ? supply[1] : cur;
+    float westSupply = owner[-1] == curOwner ? supply[-1] : cur;
+    float southSupply = owner[stride] == curOwner ? supply[stride] : cur;
+    float northSupply = owner[-stride] == curOwner ? supply[-stride] : cur;
+
+    float dsdx2 = (eastSupply - cur) - (cur - westSupply);
+    float dsdy2 = (southSupply - cur) - (cur - northSupply);
+
+    float supplyTransfer = (dsdx2 + dsdy2) * diffusionRate + generation * development;
+    return cur + supplyTransfer * delta;
+}
+
+#ifdef __SSE2__
+// Picks b where mask is set, a elsewhere
+static inline __m128 select(__m128 a, __m128 b, __m128 mask)
+{
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+// Diffuses 4 consecutive chunks, with the same pointers as diffuseChunk.
+static inline void diffuse4(const float* supply, const int* owner, int stride, const float* generation,
+                            const float* development, __m128 rate, __m128 delta, __m128 decay, float* out)
+{
+    __m128 cur = _mm_loadu_ps(supply);
+    __m128i curOwner = _mm_loadu_si128((const __m128i*) owner);
+
+    __m128 sameEast = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (owner + 1)), curOwner));
+    __m128 sameWest = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (owner - 1)), curOwner));
+    __m128 sameSouth = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (owner + stride)), curOwner));
+    __m128 sameNorth = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (owner - stride)), curOwner));
+
+    __m128 eastSupply = select(cur, _mm_loadu_ps(supply + 1), sameEast);
+    __m128 westSupply = select(cur, _mm_loadu_ps(supply - 1), sameWest);
+    __m128 southSupply = select(cur, _mm_loadu_ps(supply + stride), sameSouth);
+    __m128 northSupply = select(cur, _mm_loadu_ps(supply - stride), sameNorth);
+
+    __m128 dsdx2 = _mm_sub_ps(_mm_sub_ps(eastSupply, cur), _mm_sub_ps(cur, westSupply));
+    __m128 dsdy2 = _mm_sub_ps(_mm_sub_ps(southSupply, cur), _mm_sub_ps(cur, northSupply));
+    __m128 effectiveGeneration = _mm_mul_ps(_mm_loadu_ps(generation), _mm_loadu_ps(development));
+    __m128 ownedTransfer = _mm_add_ps(_mm_mul_ps(_mm_add_ps(dsdx2, dsdy2), rate), effectiveGeneration);
+
+    // Unowned chunks lose max(decay, -supply), the same as std::max(decay, -supply)
+    __m128 negCur = _mm_xor_ps(cur, _mm_set1_ps(-0.f));
+    __m128 unownedTransfer = select(decay, negCur, _mm_cmplt_ps(decay, negCur));
+
+    __m128 unowned = _mm_castsi128_ps(_mm_cmpeq_epi32(curOwner, _mm_set1_epi32(-1)));
+    __m128 transfer = select(ownedTransfer, unownedTransfer, unowned);
+
+    _mm_storeu_ps(out, _mm_add_ps(cur, _mm_mul_ps(transfer, delta)));
+}
+#endif
+
+void diffuseSupply(int size, const float* supply, const int* owner, const float* generation,
+                   const float* development, float diffusionRate, float delta, float* out)
+{
+    int stride = size + 2;
+    for (int y = 0; y < size; y++)
+    {
+        // Skip the ring's row above and column to the left
+        const float* supplyRow = supply + (y + 1) * stride + 1;
+        const int* ownerRow = owner + (y + 1) * stride + 1;
+        int x = 0;
+
+#ifdef __SSE2__
+        __m128 rate = _mm_set1_ps(diffusionRate);
+        __m128 deltaVec = _mm_set1_ps(delta);
+        __m128 decay = _mm_set1_ps(10.f * -delta);
+        for (; x + 4 <= size; x += 4)
+            diffuse4(supplyRow + x, ownerRow + x, stride, generation + y * size + x, development + y * size + x,
+                     rate, deltaVec, decay, out + y * size + x);
+#endif
+
+        for (; x < size; x++)
+            out[y * size + x] = diffuseChunk(supplyRow + x, ownerRow + x, stride, generation[y * size + x],
+                                             development[y * size + x], diffusionRate, delta);
+    }
+}
@@ -0,0 +1,72 @@
+#include "world/telemetry.h"
+#include <algorithm>
+#include <iostream>
+#include "world/world.h"
+
+Telemetry::~Telemetry()
+{
+    if (file != nullptr) std::fclose(file);
+}
+
+bool Telemetry::open(const std::string& path, int numTeams, int interval)
+{
+    if (file != nullptr) std::fclose(file);
+
+    file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to open telemetry file \"" << path << "\"" << std::endl;
+        return false;
+    }
+
+    this->numTeams = numTeams;
+    this->interval = std::max(1, interval);
+
+    std::fprintf(file, "seed,step,time");
+    for (int team = 0; team < numTeams; team++)
+    {
+        std::fprintf(file, ",team%d_cells,team%d_owned_chunks,team%d_attack,team%d_defense,team%d_speed,"
+                           "team%d_metabolism,team%d_supply", team, team, team, team, team, team, team);
+    }
+    for (int phase = 0; phase < NUM_STEP_PHASES; phase++)
+        std::fprintf(file, ",%s_ns", getStepPhaseName((StepPhase) phase));
+    std::fprintf(file, "\n");
+
+    return true;
+}
+
+void Telemetry::beginRun(const World& world, int seed)
+{
+    this->seed = seed;
+    step = 0;
+    lastPhaseTimes = world.getPhaseTimes();
+}
+
+void Telemetry::sample(const World& world)
+{
+    step++;
+    if (file == nullptr || step % interval != 0) return;
+
+    std::fprintf(file, "%d,%llu,%f", seed, (unsigned long long) step, world.getWorldTime());
+
+    auto stats = world.getTeamStats();
+    auto supply = world.getTeamSupply();
+    for (int team = 0; team < numTeams; team++)
+    {
+        auto& s = stats[team];
+        std::fprintf(file, ",%d,%d,%f,%f,%f,%f,%f", s.cellCount, s.ownedChunks, s.averageAttack,
+                     s.averageDefense, s.averageSpeed, s.averageMetabolism, supply[team]);
+    }
+
+    // Phase times only grow, unless the world's were reset since the last row
+    auto& phaseTimes = world.getPhaseTimes();
+    for (int phase = 0; phase < NUM_STEP_PHASES; phase++)
+    {
+        uint64_t elapsed = phaseTimes[phase] >= lastPhaseTimes[phase] ? phaseTimes[phase] - lastPhaseTimes[phase] :
+                           phaseTimes[phase];
+        std::fprintf(file, ",%llu", (unsigned long long) elapsed);
+    }
+    lastPhaseTimes = phaseTimes;
+
+    std::fprintf(file, "\n");
+}
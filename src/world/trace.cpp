@@ -0,0 +1,175 @@
+#include "world/trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Deepest nesting of open events tracked per thread. Deeper events are still recorded but can't hold counters.
+#define MAX_TRACE_DEPTH 64
+
+struct TraceEvent
+{
+    const char* name;
+    // Nanoseconds since traceEpoch. end is 0 while the event is open.
+    uint64_t start;
+    uint64_t end;
+    int numCounters;
+    const char* counterNames[Trace::MAX_COUNTERS];
+    int64_t counterValues[Trace::MAX_COUNTERS];
+};
+
+struct ThreadTrace
+{
+    int threadId = 0;
+
+    // Sequence number of the next event. Event n lives at events[n % RING_SIZE] until RING_SIZE more are begun.
+    uint64_t next = 0;
+    std::vector<TraceEvent> events = std::vector<TraceEvent>(Trace::RING_SIZE);
+
+    int depth = 0;
+    uint64_t open[MAX_TRACE_DEPTH];
+
+    TraceEvent* find(uint64_t event)
+    { return next - event > Trace::RING_SIZE ? nullptr : &events[event % Trace::RING_SIZE]; }
+};
+
+static const auto traceEpoch = std::chrono::steady_clock::now();
+
+// Every thread that ever recorded, kept after it exits so its events can still be written
+static std::mutex threadsMutex;
+static std::vector<std::unique_ptr<ThreadTrace>> threads;
+
+static thread_local ThreadTrace* currentThread = nullptr;
+
+static uint64_t now()
+{
+    auto elapsed = std::chrono::steady_clock::now() - traceEpoch;
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+static ThreadTrace& getThread()
+{
+    if (currentThread == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threads.push_back(std::make_unique<ThreadTrace>());
+        threads.back()->threadId = (int) threads.size();
+        currentThread = threads.back().get();
+    }
+    return *currentThread;
+}
+
+uint64_t Trace::begin(const char* name)
+{
+    auto& thread = getThread();
+    uint64_t event = thread.next++;
+
+    auto& e = thread.events[event % RING_SIZE];
+    e.name = name;
+    e.start = now();
+    e.end = 0;
+    e.numCounters = 0;
+
+    if (thread.depth < MAX_TRACE_DEPTH) thread.open[thread.depth] = event;
+    thread.depth++;
+    return event;
+}
+
+void Trace::end(uint64_t event)
+{
+    auto& thread = getThread();
+    thread.depth--;
+
+    // A scope holding more than RING_SIZE events has lost its own
+    if (auto* e = thread.find(event))
+        e->end = std::max(now(), e->start + 1);
+}
+
+void Trace::counter(const char* name, int64_t value)
+{
+    auto& thread = getThread();
+    if (thread.depth == 0 || thread.depth > MAX_TRACE_DEPTH) return;
+
+    auto* e = thread.find(thread.open[thread.depth - 1]);
+    if (e == nullptr) return;
+
+    for (int i = 0; i < e->numCounters; i++)
+    {
+        if (std::strcmp(e->counterNames[i], name) == 0)
+        {
+            e->counterValues[i] += value;
+            return;
+        }
+    }
+
+    if (e->numCounters == MAX_COUNTERS) return;
+    e->counterNames[e->numCounters] = name;
+    e->counterValues[e->numCounters] = value;
+    e->numCounters++;
+}
+
+bool Trace::writeChromeJson(const std::string& path)
+{
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        std::cerr << "Failed to open trace file \"" << path << "\"" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+
+    // Timestamps are in microseconds
+    const char* separator = "";
+    std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (auto& thread: threads)
+    {
+        std::fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                           "\"args\":{\"name\":\"thread %d\"}}", separator, thread->threadId, thread->threadId);
+        separator = ",";
+
+        uint64_t first = thread->next > RING_SIZE ? thread->next - RING_SIZE : 0;
+        for (uint64_t event = first; event < thread->next; event++)
+        {
+            auto& e = thread->events[event % RING_SIZE];
+            if (e.end == 0) continue;
+
+            std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                         e.name, thread->threadId, (double) e.start / 1000.0, (double) (e.end - e.start) / 1000.0);
+            if (e.numCounters > 0)
+            {
+                std::fprintf(file, ",\"args\":{");
+                for (int i = 0; i < e.numCounters; i++)
+                {
+                    std::fprintf(file, "%s\"%s\":%lld", i == 0 ? "" : ",", e.counterNames[i],
+                                 (long long) e.counterValues[i]);
+                }
+                std::fprintf(file, "}");
+            }
+            std::fprintf(file, "}");
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+
+    bool written = std::ferror(file) == 0;
+    if (std::fclose(file) != 0 || !written)
+    {
+        std::cerr << "Failed to write trace file \"" << path << "\"" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Trace::clear()
+{
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (auto& thread: threads)
+    {
+        thread->next = 0;
+        thread->depth = 0;
+    }
+}
@@ -1,71 +1,258 @@
 #include "world/world.h"
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <thread>
 #include <utility>
 #include <iostream>
 #include "utils.h"
+#include "world/random.h"
+#include "world/supply_diffusion.h"
+#include "world/trace.h"
 
 #define PI_f 3.14159265359f
 
+// Independent random streams derived from the world seed
+#define CHUNK_STREAM 1
+#define INITIAL_CELL_STREAM 2
+#define CHILD_STREAM 3
+
+// Below this many cells per task, splitting a phase costs more than it saves.
+#define MIN_CELLS_PER_TASK 256
+
+size_t World::taskCount(size_t count)
+{
+    size_t maxTasks = (size_t) pool.size() + 1;
+    return std::max((size_t) 1, std::min(maxTasks, count / MIN_CELLS_PER_TASK));
+}
+
+template<class F>
+void World::parallelFor(size_t count, F f)
+{
+    // The calling thread runs tasks too instead of idling.
+    pool.parallel_for(count, taskCount(count), [&](size_t task, size_t begin, size_t end)
+    {
+        TRACE_SCOPE("task");
+        TRACE_COUNTER("items", end - begin);
+        f(task, begin, end);
+    });
+}
+
 void World::updateTerritories(float delta)
 {
-    // Reuse these
-    std::vector<uint32_t> cellCounts(settings.numTeams);
-    std::vector<float> ownershipTarget(settings.numTeams);
+    auto& cellCounts = territoryCellCounts;
+    auto& ownershipTarget = territoryTargets;
 
-    for (int x = 0; x < settings.numChunks.x; x++)
+    // Every chunk reads its neighbors' ownership from before the phase, so the order chunks are visited in
+    // doesn't matter. The new values are applied once all are computed.
+    ownershipUpdates.clear();
+
+    size_t numActive = 0;
+    for (int index: activeChunks)
     {
-        for (int y = 0; y < settings.numChunks.y; y++)
+        float claimSpeed = 1.f;
+        sf::Vector2i pos = getChunkPos(index);
+        auto& tile = allocateTile(index);
+        int local = index % CHUNK_TILE_AREA;
+        const float* teamOwnership = &tile.ownership[local * settings.numTeams];
+
+        // Empty chunks never change, and neither do chunks held outright by the only team in them. Either stays
+        // that way until a cell enters, which reactivates it.
+        int presentTeam = -1;
+        bool settled = true;
+        for (int i = 0; i < settings.numTeams && settled; i++)
+        {
+            if (getCellList(index, i).empty()) continue;
+            settled = presentTeam == -1;
+            presentTeam = i;
+        }
+        if (settled && presentTeam != -1)
+        {
+            uint64_t presentBit = (uint64_t) 1 << presentTeam;
+            settled = tile.full[local] == presentBit && tile.claimed[local] == presentBit;
+        }
+
+        if (settled)
         {
-            float claimSpeed = 1.f;
-            auto& chunk = getChunk({x, y});
+            tile.active[local] = false;
+            continue;
+        }
+        activeChunks[numActive++] = index;
+
+        uint32_t total = 0;
+        for (int i = 0; i < settings.numTeams; i++)
+        {
+            auto count = getCellList(index, i).size();
+
+            if (count > 0 && (isClaimable(pos, i)))
+            {
+                total += count;
+                cellCounts[i] = count;
+            }
+            else cellCounts[i] = 0;
+        }
 
-            uint32_t total = 0;
+        if (total != 0)
+        {
             for (int i = 0; i < settings.numTeams; i++)
             {
-                auto count = chunk->cells[i].size();
+                ownershipTarget[i] = (float) cellCounts[i] / (float) total;
+                float ownership = teamOwnership[i];
 
-                if (count > 0 && (isClaimable({x, y}, i)))
+                // Move towards ownershipTarget
+                if (ownership > ownershipTarget[i])
                 {
-                    total += count;
-                    cellCounts[i] = count;
+                    ownership -= delta * claimSpeed;
+                    ownership = clamp(ownership, ownershipTarget[i], 1.f);
                 }
-                else cellCounts[i] = 0;
+                else
+                {
+                    ownership += delta * claimSpeed;
+                    ownership = clamp(ownership, 0.f, ownershipTarget[i]);
+                }
+
+                if (ownership != teamOwnership[i])
+                    ownershipUpdates.push_back({index, i, ownership});
             }
+        }
+    }
+    activeChunks.resize(numActive);
+    TRACE_COUNTER("chunks", numActive);
 
-            if (total != 0)
-            {
-                for (int i = 0; i < settings.numTeams; i++)
-                {
-                    ownershipTarget[i] = (float) cellCounts[i] / (float) total;
+    for (auto& update: ownershipUpdates)
+    {
+        setOwnership(update.index, update.teamId, update.ownership);
+        markTerritoryDirty(getChunkPos(update.index));
+    }
+}
 
-                    // Move towards ownershipTarget
-                    if (chunk->teamOwnership[i] > ownershipTarget[i])
-                    {
-                        chunk->teamOwnership[i] -= delta * claimSpeed;
-                        chunk->teamOwnership[i] = clamp(chunk->teamOwnership[i], ownershipTarget[i], 1.f);
-                    }
-                    else
-                    {
-                        chunk->teamOwnership[i] += delta * claimSpeed;
-                        chunk->teamOwnership[i] = clamp(chunk->teamOwnership[i], 0.f, ownershipTarget[i]);
-                    }
-                }
+void World::activateChunk(sf::Vector2i pos)
+{
+    int index = getChunkIndex(pos);
+    bool& active = allocateTile(index).active[index % CHUNK_TILE_AREA];
+    if (active) return;
+    active = true;
+    activeChunks.push_back(index);
+}
+
+void World::markTerritoryDirty(sf::Vector2i pos)
+{
+    // Tiles without a texture color every chunk once they come into view
+    auto& tile = getOverlayTile(pos);
+    if (tile.pixels.empty()) return;
+
+    auto index = getChunkIndex(pos);
+    bool& dirty = allocateTile(index).territoryDirty[index % CHUNK_TILE_AREA];
+    if (dirty) return;
+    dirty = true;
+    tile.dirtyTerritories.push_back(pos);
+}
+
+World::OverlayTile& World::getOverlayTile(sf::Vector2i pos) const
+{
+    return overlayTiles[pos.x / OVERLAY_TILE_CHUNKS + pos.y / OVERLAY_TILE_CHUNKS * numOverlayTiles.x];
+}
+
+void World::setOverlayPixel(sf::Vector2i pos, sf::Color color) const
+{
+    auto& tile = getOverlayTile(pos);
+    int x = pos.x % OVERLAY_TILE_CHUNKS;
+    int y = pos.y % OVERLAY_TILE_CHUNKS;
+
+    sf::Uint8* pixel = &tile.pixels[(x + y * tile.width) * 4];
+    if (pixel[0] == color.r && pixel[1] == color.g && pixel[2] == color.b && pixel[3] == color.a)
+        return;
+
+    pixel[0] = color.r;
+    pixel[1] = color.g;
+    pixel[2] = color.b;
+    pixel[3] = color.a;
+    tile.version++;
+}
+
+void World::updateOverlayTile(sf::Vector2i tilePos) const
+{
+    TRACE_SCOPE("updateOverlayTile");
+    auto& tile = overlayTiles[tilePos.x + tilePos.y * numOverlayTiles.x];
+    sf::Vector2i origin = tilePos * OVERLAY_TILE_CHUNKS;
+    sf::Vector2i size = {std::min(OVERLAY_TILE_CHUNKS, settings.numChunks.x - origin.x),
+                         std::min(OVERLAY_TILE_CHUNKS, settings.numChunks.y - origin.y)};
+
+    if (tile.pixels.empty())
+    {
+        // Created lazily so that parts of the world that are never looked at don't need pixels
+        tile.pixels.resize(size.x * size.y * 4);
+        tile.width = size.x;
+        tile.version++;
+    }
 
-                updateTerritoryColor({x, y}, chunk);
+    bool modeChanged = tile.mode != viewMode;
+    tile.mode = viewMode;
+
+    if (viewMode == ViewMode::DEFAULT)
+    {
+        if (modeChanged)
+        {
+            for (int y = origin.y; y < origin.y + size.y; y++)
+                for (int x = origin.x; x < origin.x + size.x; x++)
+                    updateTerritoryColor({x, y});
+        }
+        else
+        {
+            for (auto pos: tile.dirtyTerritories)
+                updateTerritoryColor(pos);
+            TRACE_COUNTER("chunks", tile.dirtyTerritories.size());
+        }
+
+        for (auto pos: tile.dirtyTerritories)
+        {
+            // Queued chunks are in allocated tiles
+            int index = getChunkIndex(pos);
+            tiles[index / CHUNK_TILE_AREA]->territoryDirty[index % CHUNK_TILE_AREA] = false;
+        }
+        tile.dirtyTerritories.clear();
+    }
+    else if (viewMode == ViewMode::SUPPLY)
+    {
+        for (int y = origin.y; y < origin.y + size.y; y++)
+        {
+            for (int x = origin.x; x < origin.x + size.x; x++)
+            {
+                int i = getChunkIndex({x, y});
+                float supply = getTile(i).supply[i % CHUNK_TILE_AREA];
+                sf::Vector3f colorVec = supply * sf::Vector3f(255.f, 255.f, 255.f) / (10.f * maxSupplyGeneration);
+                setOverlayPixel({x, y}, sf::Color((uint8_t) colorVec.x, (uint8_t) colorVec.y, (uint8_t) colorVec.z));
             }
         }
     }
+    else if (viewMode == ViewMode::SUPPLY_GENERATION)
+    {
+        for (int y = origin.y; y < origin.y + size.y; y++)
+        {
+            for (int x = origin.x; x < origin.x + size.x; x++)
+            {
+                int i = getChunkIndex({x, y});
+                float effectiveGeneration = chunkSupplyGeneration[i] * getTile(i).development[i % CHUNK_TILE_AREA];
+                sf::Vector3f colorVec = effectiveGeneration * sf::Vector3f(255.f, 255.f, 255.f) / maxSupplyGeneration;
+                setOverlayPixel({x, y}, sf::Color((uint8_t) colorVec.x, (uint8_t) colorVec.y, (uint8_t) colorVec.z));
+            }
+        }
+    }
+    // else impossible
 }
 
-void World::updateTerritoryColor(sf::Vector2i pos, const std::unique_ptr<Chunk>& chunk)
+void World::updateTerritoryColor(sf::Vector2i pos) const
 {
+    int index = getChunkIndex(pos);
+    const float* teamOwnership = &getTile(index).ownership[index % CHUNK_TILE_AREA * settings.numTeams];
+
     sf::Vector3f colorVec;
     for (int i = 0; i < settings.numTeams; i++)
     {
-        colorVec.x += (float) settings.teamColors[i].r * chunk->teamOwnership[i];
-        colorVec.y += (float) settings.teamColors[i].g * chunk->teamOwnership[i];
-        colorVec.z += (float) settings.teamColors[i].b * chunk->teamOwnership[i];
+        colorVec.x += (float) settings.teamColors[i].r * teamOwnership[i];
+        colorVec.y += (float) settings.teamColors[i].g * teamOwnership[i];
+        colorVec.z += (float) settings.teamColors[i].b * teamOwnership[i];
     }
     sf::Color color = sf::Color::Black;
     color.r = (uint8_t) colorVec.x;
@@ -73,299 +260,433 @@ void World::updateTerritoryColor(sf::Vector2i pos, const std::unique_ptr<Chunk>&
     color.b = (uint8_t) colorVec.z;
     color.a = 127;
 
-    territoryMap->setPixel(pos.x, pos.y, color);
+    setOverlayPixel(pos, color);
 }
 
 void World::developChunks(float delta)
 {
-    for(auto& chunk : chunks) {
-        if(chunk->getCurrentOwner() == -1)
-        {
-            chunk->development -= delta;
-            if(chunk->development < 0) chunk->development = 0;
-        }
-        else
+    // Chunks of unallocated tiles were never owned, so they stay undeveloped
+    for (int tileIndex: allocatedTiles)
+    {
+        auto& tile = *tiles[tileIndex];
+        for (int i = 0; i < CHUNK_TILE_AREA; i++)
         {
-            chunk->development += delta / 120.f;
-            if(chunk->development > 1.f) chunk->development = 1.f;
+            float& development = tile.development[i];
+            if(tile.owner[i] == -1)
+            {
+                development -= delta;
+                if(development < 0) development = 0;
+            }
+            else
+            {
+                development += delta / 120.f;
+                if(development > 1.f) development = 1.f;
+            }
         }
     }
+    TRACE_COUNTER("chunks", allocatedTiles.size() * CHUNK_TILE_AREA);
 }
 
 void World::updateChunkSupply(float delta)
 {
-    static std::vector<int> ownerBuffer(settings.numChunks.x * settings.numChunks.y);
-    static std::vector<float> transferBuffer(settings.numChunks.x * settings.numChunks.y);
-
-    for (int x = 0; x < settings.numChunks.x; x++)
-        for (int y = 0; y < settings.numChunks.y; y++)
-            ownerBuffer[x + y * settings.numChunks.x] = getChunk({x, y})->getCurrentOwner();
-
-    for (int x = 0; x < settings.numChunks.x; x++)
+    // Chunks of unallocated tiles are unowned and hold no supply, so they stay at zero and neither give nor take
+    // any. Each allocated tile is diffused with a ring of its neighbors' supply and owners, and the results are
+    // written back once every tile has read its neighbors.
+    const int paddedSize = CHUNK_TILE_SIZE + 2;
+    TRACE_COUNTER("chunks", allocatedTiles.size() * CHUNK_TILE_AREA);
+    paddedSupply.resize(paddedSize * paddedSize);
+    paddedOwner.resize(paddedSize * paddedSize);
+    supplyBuffer.resize(allocatedTiles.size() * CHUNK_TILE_AREA);
+
+    for (size_t t = 0; t < allocatedTiles.size(); t++)
     {
-        for (int y = 0; y < settings.numChunks.y; y++)
+        int tileIndex = allocatedTiles[t];
+        auto& tile = *tiles[tileIndex];
+
+        for (int y = 0; y < CHUNK_TILE_SIZE; y++)
         {
-            auto& curChunk = getChunk({x, y});
-            auto curChunkOwner = ownerBuffer[x + y * settings.numChunks.x];
+            std::copy_n(&tile.supply[y * CHUNK_TILE_SIZE], CHUNK_TILE_SIZE, &paddedSupply[(y + 1) * paddedSize + 1]);
+            std::copy_n(&tile.owner[y * CHUNK_TILE_SIZE], CHUNK_TILE_SIZE, &paddedOwner[(y + 1) * paddedSize + 1]);
+        }
 
-            if(curChunkOwner == -1)
+        // The ring, from the 8 neighboring tiles. Past the edge of the grid there is nobody to share with, the
+        // same as next to an empty tile.
+        sf::Vector2i tilePos = {tileIndex % numTiles.x, tileIndex / numTiles.x};
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
             {
-                transferBuffer[x + y * settings.numChunks.x] = std::max(10.f * -delta, -curChunk->supply);
-                continue;
+                if (dx == 0 && dy == 0) continue;
+                sf::Vector2i neighborPos = tilePos + sf::Vector2i(dx, dy);
+                const ChunkTile& neighbor = inBoundsEx(neighborPos, {0, 0}, numTiles) ?
+                        getTile((neighborPos.x + neighborPos.y * numTiles.x) * CHUNK_TILE_AREA) : *emptyTile;
+
+                // The neighbor's row or column next to this tile, or its corner chunk
+                int firstX = dx == -1 ? CHUNK_TILE_SIZE - 1 : 0;
+                int lastX = dx == 0 ? CHUNK_TILE_SIZE : firstX + 1;
+                int firstY = dy == -1 ? CHUNK_TILE_SIZE - 1 : 0;
+                int lastY = dy == 0 ? CHUNK_TILE_SIZE : firstY + 1;
+                for (int y = firstY; y < lastY; y++)
+                {
+                    for (int x = firstX; x < lastX; x++)
+                    {
+                        int padded = (x + dx * CHUNK_TILE_SIZE + 1) + (y + dy * CHUNK_TILE_SIZE + 1) * paddedSize;
+                        paddedSupply[padded] = neighbor.supply[x + y * CHUNK_TILE_SIZE];
+                        paddedOwner[padded] = neighbor.owner[x + y * CHUNK_TILE_SIZE];
+                    }
+                }
             }
-
-            float westSupply = curChunk->supply;
-            float eastSupply = curChunk->supply;
-            float northSupply = curChunk->supply;
-            float southSupply = curChunk->supply;
-
-            if (x + 1 < settings.numChunks.x && ownerBuffer[(x + 1) + y * settings.numChunks.x] == curChunkOwner)
-                eastSupply = getChunk({x + 1, y})->supply;
-            if (x - 1 >= 0 && ownerBuffer[(x - 1) + y * settings.numChunks.x] == curChunkOwner)
-                westSupply = getChunk({x - 1, y})->supply;
-            if (y + 1 < settings.numChunks.y && ownerBuffer[x + (y + 1) * settings.numChunks.x] == curChunkOwner)
-                southSupply = getChunk({x, y + 1})->supply;
-            if (y - 1 >= 0 && ownerBuffer[x + (y - 1) * settings.numChunks.x] == curChunkOwner)
-                northSupply = getChunk({x, y - 1})->supply;
-
-            float dsdx2 = (eastSupply - curChunk->supply) - (curChunk->supply - westSupply);
-            float dsdy2 = (southSupply - curChunk->supply) - (curChunk->supply - northSupply);
-
-            float supplyTransfer = (dsdx2 + dsdy2) * settings.supplyDiffusionRate + curChunk->getEffectiveSupplyGeneration();
-
-            transferBuffer[x + y * settings.numChunks.x] = supplyTransfer;
         }
-    }
 
-
-    for (int x = 0; x < settings.numChunks.x; x++)
-    {
-        for (int y = 0; y < settings.numChunks.y; y++)
-        {
-            auto& chunk = getChunk({x, y});
-            chunk->supply += transferBuffer[x + y * settings.numChunks.x] * delta;
-        }
+        diffuseSupply(CHUNK_TILE_SIZE, paddedSupply.data(), paddedOwner.data(),
+                      &chunkSupplyGeneration[tileIndex * CHUNK_TILE_AREA], tile.development,
+                      settings.supplyDiffusionRate, delta, &supplyBuffer[t * CHUNK_TILE_AREA]);
     }
+
+    for (size_t t = 0; t < allocatedTiles.size(); t++)
+        std::copy_n(&supplyBuffer[t * CHUNK_TILE_AREA], CHUNK_TILE_AREA, tiles[allocatedTiles[t]]->supply);
 }
 
-void World::updateCellSupply(float delta)
+void World::spendCellSupply(float delta)
 {
-    for(auto& cell : cells) {
-        if(cell->supply >= 1.f && cell->numChildren < 2)
+    // Cells first ask their chunk for supply, then shareChunkSupply shares what each chunk has in proportion to the
+    // demand, so no cell is favored by where it sits in the store.
+    supplyDemand.resize(cells.size());
+    TRACE_COUNTER("cells", cells.size());
+    for(size_t i = 0; i < cells.size(); i++) {
+        float& supply = cells.supply[i];
+        if(supply >= 1.f && cells.numChildren[i] < 2)
         {
             float childProgressTransfer = delta / settings.childSpawnDelay * 2.f;
-            cell->supply -= childProgressTransfer;
-            cell->childProgress += childProgressTransfer;
+            supply -= childProgressTransfer;
+            cells.childProgress[i] += childProgressTransfer;
         }
 
-        float passiveLoss = delta * 0.0075f * (cell->supply * cell->supply + 5.f);
-        passiveLoss /= cell->metabolism;
-        cell->supply -= passiveLoss;
+        float passiveLoss = delta * 0.0075f * (supply * supply + 5.f);
+        passiveLoss /= cells.metabolism[i];
+        supply -= passiveLoss;
 
-        if(cell->supply < 0)
+        if(supply < 0)
         {
-            cell->health += cell->supply;
-            cell->supply = 0;
+            bool wasAlive = cells.health[i] > 0;
+            cells.health[i] += supply;
+            supply = 0;
+            if(wasAlive && cells.health[i] <= 0) killCell((uint32_t) i);
         }
 
-        if(cell->numChildren >= 2) continue;
+        supplyDemand[i] = 0.f;
+        if(cells.numChildren[i] >= 2) continue;
+
+        // A cell's chunk is always allocated, so this leaves the tiles alone while other phases walk them
+        auto centerPos = worldToChunkPos(cells.position[i]);
+        int chunkIndex = getChunkIndex(centerPos);
+        auto& tile = *tiles[chunkIndex / CHUNK_TILE_AREA];
+        int local = chunkIndex % CHUNK_TILE_AREA;
+        if(!(tile.full[local] >> cells.teamId[i] & 1)) continue;
 
-        auto centerPos = worldToChunkPos(cell->position);
+        // Up to delta for every chunk of the 3x3 neighborhood in bounds, all drawn from the center chunk
+        int numNeighbors = 0;
         for(int ox = -1; ox <= 1; ox++)
-        {
             for(int oy = -1; oy <= 1; oy++)
-            {
-                if(!inBoundsEx(centerPos + sf::Vector2i(ox, oy), {0, 0}, settings.numChunks))
-                    continue;
-                auto& chunk = getChunk(worldToChunkPos(cell->position));
-                if(chunk->teamOwnership[cell->teamId] != 1.f) continue;
-                auto t = std::min(std::min(delta, chunk->supply), 1.f - cell->supply);
-                cell->supply += t;
-                chunk->supply -= t;
-            }
-        }
+                if(inBoundsEx(centerPos + sf::Vector2i(ox, oy), {0, 0}, settings.numChunks))
+                    numNeighbors++;
 
-    }
+        float demand = std::max(0.f, std::min(delta * (float) numNeighbors, 1.f - supply));
+        if(demand == 0.f) continue;
 
-    deleteDeadCells();
+        if(tile.demand[local] == 0.f) demandChunks.push_back(chunkIndex);
+        tile.demand[local] += demand;
+        supplyDemand[i] = demand;
+    }
 }
 
-void World::updateVelocities(float delta)
+void World::shareChunkSupply(float delta)
 {
-    float cellViewRange = 2;
+    TRACE_COUNTER("cells", cells.size());
+    for(size_t i = 0; i < cells.size(); i++) {
+        if(supplyDemand[i] == 0.f) continue;
+        int chunkIndex = getChunkIndex(worldToChunkPos(cells.position[i]));
+        auto& tile = getTile(chunkIndex);
+        int local = chunkIndex % CHUNK_TILE_AREA;
+        float share = std::min(1.f, tile.supply[local] / tile.demand[local]);
+        cells.supply[i] += supplyDemand[i] * share;
+    }
 
-    for (auto& c: cells)
-    {
-        bool needSupply = c->supply < 0.9f;
+    for(int chunkIndex : demandChunks) {
+        auto& tile = allocateTile(chunkIndex);
+        int local = chunkIndex % CHUNK_TILE_AREA;
+        tile.supply[local] = std::max(0.f, tile.supply[local] - tile.demand[local]);
+        tile.demand[local] = 0.f;
+    }
+    demandChunks.clear();
+}
 
-        auto centerPos = worldToChunkPos(c->position);
-        int rectRadius = (int) ceilf(cellViewRange);
+Steering World::computeSteering(sf::Vector2i centerPos, int teamId) const
+{
+    float cellViewRange = 2;
+    int rectRadius = (int) ceilf(cellViewRange);
 
-        sf::Vector2f targetVelocity = {0, 0};
+    Steering steering = {{0, 0}, {0, 0}};
 
-        for (int ox = -rectRadius; ox <= rectRadius; ox++)
+    for (int ox = -rectRadius; ox <= rectRadius; ox++)
+    {
+        for (int oy = -rectRadius; oy <= rectRadius; oy++)
         {
-            for (int oy = -rectRadius; oy <= rectRadius; oy++)
-            {
-                if(ox == 0 && oy == 0) continue;
+            if(ox == 0 && oy == 0) continue;
 
-                sf::Vector2i offsetPos = {ox + centerPos.x, oy + centerPos.y};
-                if (!inBoundsEx(offsetPos, {0, 0}, settings.numChunks))
-                    continue;
-
-                int distSq = ox * ox + oy * oy;
-                auto& chunk = getChunk(offsetPos);
+            sf::Vector2i offsetPos = {ox + centerPos.x, oy + centerPos.y};
+            if (!inBoundsEx(offsetPos, {0, 0}, settings.numChunks))
+                continue;
 
-                bool isClaimed = chunk->teamOwnership[c->teamId] == 1.f;
+            int distSq = ox * ox + oy * oy;
+            if ((float) distSq > cellViewRange * cellViewRange) continue;
 
-                if ((float) distSq <= cellViewRange * cellViewRange)
-                {
-                    bool needsDefense = isEdge(offsetPos, c->teamId) ||
-                            (isClaimable(offsetPos, c->teamId) && chunk->teamOwnership[c->teamId] < 1);
+            int chunkIndex = getChunkIndex(offsetPos);
+            auto& tile = getTile(chunkIndex);
+            int local = chunkIndex % CHUNK_TILE_AREA;
 
-                    float weight;
+            bool isClaimed = tile.full[local] >> teamId & 1;
+            bool needsDefense = (tile.edge[local] >> teamId & 1) ||
+                    ((tile.claimable[local] >> teamId & 1) && !isClaimed);
 
-                    if((needSupply && isClaimed) && needsDefense)
-                    {
-                        // Encourage cells to go to undefended areas
-                        float uniformDefenseWeight = 1.f / ((float)chunk->cells[c->teamId].size() + 1.f);
+            auto offsetDist = sqrtf((float)(ox * ox + oy * oy));
+            sf::Vector2f vecWeight = sf::Vector2f((float) ox, (float) oy) / (offsetDist);
 
-                        weight = std::min(1.f, chunk->supply) * std::max(1.f, 10.f * uniformDefenseWeight);
-                    }
-                    else if(needSupply && isClaimed)
-                    {
-                        // Need supply but chunk doesnt need defense
-                        weight = std::min(1.f, chunk->supply);
-                    }
-                    else if(needsDefense)
-                    {
-                        // Chunk needs defense and cell doesn't need supply
-
-                        // Encourage cells to go to undefended areas
-                        float uniformDefenseWeight = 1.f / ((float)chunk->cells[c->teamId].size() + 1.f);
-                        weight = uniformDefenseWeight;
-                    }
-                    else
-                    {
-                        // Don't need supply and chunk doesn't need defense.
-                        continue;
-                    }
+            // Encourage cells to go to undefended areas
+            size_t numCells = tile.cells.empty() ? 0 : tile.cells[local * settings.numTeams + teamId].size();
+            float uniformDefenseWeight = 1.f / ((float) numCells + 1.f);
 
-                    auto offsetDist = sqrtf((float)(ox * ox + oy * oy));
-                    sf::Vector2f vecWeight = sf::Vector2f((float) ox, (float) oy) / (offsetDist);
-                    targetVelocity += weight * vecWeight;
-                }
+            if(isClaimed && needsDefense)
+            {
+                float weight = std::min(1.f, tile.supply[local]) * std::max(1.f, 10.f * uniformDefenseWeight);
+                steering.needSupply += weight * vecWeight;
+            }
+            else if(isClaimed)
+            {
+                // Need supply but chunk doesnt need defense
+                steering.needSupply += std::min(1.f, tile.supply[local]) * vecWeight;
+            }
+            else if(needsDefense)
+            {
+                steering.needSupply += uniformDefenseWeight * vecWeight;
             }
-        }
 
-        if(std::abs(targetVelocity.x) < 0.01f && std::abs(targetVelocity.y) < 0.01f)
-            targetVelocity = c->preferredVelocity;
-        auto targetVelocityMag = sqrtf(targetVelocity.x * targetVelocity.x + targetVelocity.y * targetVelocity.y);
-        targetVelocity /= targetVelocityMag;
-        targetVelocity *= 50.f;
-        c->velocity = (1 - delta) * c->velocity + delta * targetVelocity;
+            // Cells that don't need supply only go where defense is needed
+            if(needsDefense)
+                steering.noNeedSupply += uniformDefenseWeight * vecWeight;
+        }
     }
+
+    return steering;
 }
 
-void World::updatePositions(float delta)
+void World::updateVelocities(float delta)
 {
-    for (auto& cell: cells)
+    // Every cell of a team in a chunk is steered the same way, so each (chunk, team) pair holding cells is
+    // computed once
+    if (++steeringEpoch == 0)
     {
-        sf::Vector2f newPos = cell->position + cell->velocity * delta * cell->speed;
-        if (newPos.x < 0)
-        {
-            newPos.x = 0;
-            cell->velocity.x *= -1;
-            cell->preferredVelocity.x *= -1;
-        }
-        else if (newPos.x >= (float) settings.width - 1e-4f)
+        for (int tileIndex: allocatedTiles)
+            std::fill(tiles[tileIndex]->steeringStamp.begin(), tiles[tileIndex]->steeringStamp.end(), 0);
+        steeringEpoch = 1;
+    }
+
+    // Pairs index the steering of their chunk's tile at pair % (CHUNK_TILE_AREA * numTeams)
+    uint32_t pairsPerTile = CHUNK_TILE_AREA * settings.numTeams;
+
+    steeringPairs.clear();
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        if (cells.health[i] <= 0) continue;
+        uint32_t pair = getChunkIndex(worldToChunkPos(cells.position[i])) * settings.numTeams + cells.teamId[i];
+        uint32_t& stamp = tiles[pair / pairsPerTile]->steeringStamp[pair % pairsPerTile];
+        if (stamp == steeringEpoch) continue;
+        stamp = steeringEpoch;
+        steeringPairs.push_back(pair);
+    }
+    TRACE_COUNTER("cells", cells.size());
+    TRACE_COUNTER("chunks", steeringPairs.size());
+
+    parallelFor(steeringPairs.size(), [&](size_t task, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
         {
-            newPos.x = (float) settings.width - 1e-4f;
-            cell->velocity.x *= -1;
-            cell->preferredVelocity.x *= -1;
+            uint32_t pair = steeringPairs[i];
+            sf::Vector2i centerPos = getChunkPos((int) (pair / settings.numTeams));
+            tiles[pair / pairsPerTile]->steering[pair % pairsPerTile] =
+                    computeSteering(centerPos, (int) (pair % settings.numTeams));
         }
-        if (newPos.y < 0)
+    });
+
+    parallelFor(cells.size(), [&](size_t task, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
         {
-            newPos.y = 0;
-            cell->velocity.y *= -1;
-            cell->preferredVelocity.y *= -1;
+            if (cells.health[i] <= 0) continue;
+            uint32_t pair = getChunkIndex(worldToChunkPos(cells.position[i])) * settings.numTeams + cells.teamId[i];
+            auto& steering = tiles[pair / pairsPerTile]->steering[pair % pairsPerTile];
+            sf::Vector2f targetVelocity = cells.supply[i] < 0.9f ? steering.needSupply : steering.noNeedSupply;
+
+            if(std::abs(targetVelocity.x) < 0.01f && std::abs(targetVelocity.y) < 0.01f)
+                targetVelocity = cells.preferredVelocity[i];
+            auto targetVelocityMag = sqrtf(targetVelocity.x * targetVelocity.x + targetVelocity.y * targetVelocity.y);
+            targetVelocity /= targetVelocityMag;
+            targetVelocity *= 50.f;
+            cells.velocity[i] = (1 - delta) * cells.velocity[i] + delta * targetVelocity;
         }
-        else if (newPos.y >= (float) settings.height - 1e-4f)
+    });
+}
+
+void World::updatePositions(float delta)
+{
+    TRACE_COUNTER("cells", cells.size());
+    parallelFor(cells.size(), [&](size_t task, size_t begin, size_t end)
+    {
+        auto& moves = moveBuffers[task];
+        moves.clear();
+
+        for (size_t i = begin; i < end; i++)
         {
-            newPos.y = (float) settings.height - 1e-4f;
-            cell->velocity.y *= -1;
-            cell->preferredVelocity.y *= -1;
+            // Dead cells are out of their chunks already, so they must stay put
+            if (cells.health[i] <= 0) continue;
+
+            auto& velocity = cells.velocity[i];
+            auto& preferredVelocity = cells.preferredVelocity[i];
+            sf::Vector2f newPos = cells.position[i] + velocity * delta * cells.speed[i];
+            if (newPos.x < 0)
+            {
+                newPos.x = 0;
+                velocity.x *= -1;
+                preferredVelocity.x *= -1;
+            }
+            else if (newPos.x >= (float) settings.width - 1e-4f)
+            {
+                newPos.x = (float) settings.width - 1e-4f;
+                velocity.x *= -1;
+                preferredVelocity.x *= -1;
+            }
+            if (newPos.y < 0)
+            {
+                newPos.y = 0;
+                velocity.y *= -1;
+                preferredVelocity.y *= -1;
+            }
+            else if (newPos.y >= (float) settings.height - 1e-4f)
+            {
+                newPos.y = (float) settings.height - 1e-4f;
+                velocity.y *= -1;
+                preferredVelocity.y *= -1;
+            }
+
+            // Chunk membership is shared between tasks, so record moves and apply them in cell order below.
+            auto oldChunkPos = worldToChunkPos(cells.position[i]);
+            auto newChunkPos = worldToChunkPos(newPos);
+            cells.position[i] = newPos;
+            if (newChunkPos != oldChunkPos)
+                moves.push_back({(uint32_t) i, oldChunkPos, newChunkPos});
         }
-        this->updateCellPosition(cell, newPos);
-    }
+    });
+
+    for (size_t task = 0; task < taskCount(cells.size()); task++)
+        for (auto& move: moveBuffers[task])
+            moveCellChunk(move.index, move.from, move.to);
 }
 
 void World::attackNearby(float delta)
 {
     // Attack
-    for (auto& c: cells)
+    spatialIndex.rebuild(cells);
+    TRACE_COUNTER("cells", spatialIndex.size());
+
+    // Tasks walk the index in bucket order, so attackers sharing a bucket are served together.
+    parallelFor(spatialIndex.size(), [&](size_t task, size_t begin, size_t end)
     {
-        auto closestEnemy = findNearestEnemies(*c, settings.cellAttackRange);
-        if (closestEnemy == nullptr) continue;
+        auto& damages = damageBuffers[task];
+        damages.clear();
 
-        float damageMul = c->attack * (c->supply + 0.5f) / (closestEnemy->defense * (closestEnemy->supply + 0.5f)) * 0.3f;
+        spatialIndex.forEachNearestEnemy(begin, end, settings.cellAttackRange, [&](uint32_t i, uint32_t enemy)
+        {
+            float damageMul = cells.attack[i] * (cells.supply[i] + 0.5f) / (cells.defense[enemy] * (cells.supply[enemy] + 0.5f)) * 0.3f;
 
-        closestEnemy->health -= delta * damageMul;
+            // Several attackers may hit the same enemy, so damage is applied in task order below.
+            damages.push_back({enemy, delta * damageMul});
+        });
+    });
 
-        if (closestEnemy->health < 0)
+    for (size_t task = 0; task < taskCount(spatialIndex.size()); task++)
+    {
+        for (auto& damage: damageBuffers[task])
         {
-            closestEnemy->health = 0;
+            bool wasAlive = cells.health[damage.target] > 0;
+            cells.health[damage.target] -= damage.amount;
+
+            if (cells.health[damage.target] < 0)
+            {
+                cells.health[damage.target] = 0;
+            }
+
+            if (wasAlive && cells.health[damage.target] <= 0) killCell(damage.target);
         }
     }
+}
 
-    deleteDeadCells();
+void World::killCell(uint32_t index)
+{
+    updateTeamTotals(index, -1);
+    removeFromChunk(index, worldToChunkPos(cells.position[index]));
+    killBuffer.push_back(index);
 }
 
-void World::deleteDeadCells()
+void World::removeKilledCells()
 {
-    // Kill dead cells, always incrementing iterator before deletion.
-    for (auto it = cells.begin(); it != cells.end();)
-    {
-        if (it->get()->health <= 0)
-            deleteCell(it++);
-        else it++;
-    }
+    if (killBuffer.empty()) return;
+
+    TRACE_SCOPE("removeKilledCells");
+    TRACE_COUNTER("cells", killBuffer.size());
+    // Cells before the first death keep their indices, so compaction starts there
+    cells.removeDead(*std::min_element(killBuffer.begin(), killBuffer.end()));
+    killBuffer.clear();
 }
 
 void World::spawnChildren(float delta)
 {
-    static std::uniform_real_distribution<float> angleDistrib(0.f, PI_f * 2);
-    static std::uniform_real_distribution<float> distrib01(0.f, 1);
-    static std::uniform_real_distribution<float> statMulDist(0.666f, 1.5f);
-    static std::uniform_real_distribution<float> velocityDistrib(-1.f, 1);
-    static std::uniform_int_distribution<int> seedDistrib(-(1 << 30), 1 << 30);
-    for (auto& parent: cells)
+    // Children are appended to the store, so only walk the cells that existed before spawning.
+    size_t numParents = cells.size();
+    TRACE_COUNTER("cells", numParents);
+    for (size_t i = 0; i < numParents; i++)
     {
-        if (parent->childProgress >= 2.f)
+        if (cells.childProgress[i] >= 2.f && cells.health[i] > 0)
         {
-            parent->childProgress = 0.f;
-            parent->numChildren += 1;
+            cells.childProgress[i] = 0.f;
+            cells.numChildren[i] += 1;
 
-            float angle = angleDistrib(this->generator);
-            float dist = sqrtf(distrib01(this->generator)) * 3.f;
+            // Keyed by the parent rather than drawn from a shared stream, so a child never depends on which
+            // other cells spawned before it
+            Random random(seed, CHILD_STREAM, (uint64_t) (uint32_t) cells.seed[i] << 32 |
+                                              (uint64_t) cells.teamId[i] << 8 | (uint64_t) cells.numChildren[i]);
+
+            sf::Vector2f parentPosition = cells.position[i];
+
+            float angle = random.uniform(0.f, PI_f * 2);
+            float dist = sqrtf(random.uniform(0.f, 1.f)) * 3.f;
 
             sf::Vector2f position = {
-                    cosf(angle) * dist + parent->position.x,
-                    sinf(angle) * dist + parent->position.y
+                    cosf(angle) * dist + parentPosition.x,
+                    sinf(angle) * dist + parentPosition.y
             };
             position = clamp(position, {0, 0},{(float) settings.width - 1e-4f, (float) settings.height - 1e-4f});
 
-            sf::Vector2f velocity = {velocityDistrib(generator), velocityDistrib(generator)};
+            sf::Vector2f velocity = {random.uniform(-1.f, 1.f), random.uniform(-1.f, 1.f)};
             sf::Vector2f preferredVelocity = {cosf(angle), sinf(angle)};
 
-            auto attackMult = statMulDist(generator);
-            float childAttack = parent->attack * attackMult;
-            auto defenseMult = statMulDist(generator);
-            float childDefense = parent->defense * defenseMult;
-            auto speedMult = statMulDist(generator);
-            float childSpeed = parent->speed * speedMult;
-            auto metabolismMult = statMulDist(generator);
-            float childMetabolism = parent->metabolism * metabolismMult;
+            auto attackMult = random.uniform(0.666f, 1.5f);
+            float childAttack = cells.attack[i] * attackMult;
+            auto defenseMult = random.uniform(0.666f, 1.5f);
+            float childDefense = cells.defense[i] * defenseMult;
+            auto speedMult = random.uniform(0.666f, 1.5f);
+            float childSpeed = cells.speed[i] * speedMult;
+            auto metabolismMult = random.uniform(0.666f, 1.5f);
+            float childMetabolism = cells.metabolism[i] * metabolismMult;
 
             float childStatSum = childAttack + childDefense + childSpeed + childMetabolism;
             if(childStatSum > 1)
@@ -376,28 +697,83 @@ void World::spawnChildren(float delta)
                 childMetabolism /= childStatSum;
             }
 
-            float targetSupply = distrib01(generator) > 0.5 ? 1.f : 3.f;
+            float targetSupply = random.uniform(0.f, 1.f) > 0.5 ? 1.f : 3.f;
 
-            auto child = std::make_shared<Cell>(parent->teamId, seedDistrib(generator),
-                                                childAttack, childDefense, childMetabolism, childSpeed,
-                                                1, 1, targetSupply, velocity, preferredVelocity, position);
-            sf::Vector2i chunkPos = worldToChunkPos(child->position);
-            this->cells.push_back(child);
-            auto& chunk = this->getChunk(chunkPos);
-            chunk->cells[child->teamId].push_back(child);
+            addCell(Cell(cells.teamId[i], random.uniformInt(-(1 << 30), 1 << 30),
+                         childAttack, childDefense, childMetabolism, childSpeed,
+                         1, 1, targetSupply, velocity, preferredVelocity, position));
         }
     }
 }
 
-void World::deleteCell(const std::list<std::shared_ptr<Cell>>::iterator& it)
+void World::addCell(const Cell& cell)
 {
-    auto elem = *it;
+    cells.add(cell);
+    uint32_t index = (uint32_t) cells.size() - 1;
+    insertIntoChunk(index, worldToChunkPos(cell.position));
+    updateTeamTotals(index, 1);
+}
 
-    auto& chunkCells = getChunk(worldToChunkPos(elem->position))->cells[elem->teamId];
-    chunkCells.erase(std::find(chunkCells.begin(), chunkCells.end(), elem));
+void World::insertIntoChunk(uint32_t index, sf::Vector2i pos)
+{
+    int chunkIndex = getChunkIndex(pos);
+    auto& tile = allocateTile(chunkIndex);
+    tile.allocateCells();
 
-    cells.erase(it);
+    auto& chunkCells = tile.cells[chunkIndex % CHUNK_TILE_AREA * settings.numTeams + cells.teamId[index]];
+    if (chunkCells.size() == chunkCells.capacity())
+    {
+        if (chunkCells.empty() && !spareCellLists.empty())
+        {
+            chunkCells.swap(spareCellLists.back());
+            spareCellLists.pop_back();
+        }
+        else
+        {
+            chunkCells.reserve(std::max(chunkCells.size() * 2, cellListReserve));
+        }
+    }
 
+    cells.chunkSlot[index] = (uint32_t) chunkCells.size();
+    chunkCells.push_back(cells.handle[index]);
+    peakCellListSize = std::max(peakCellListSize, chunkCells.size());
+    activateChunk(pos);
+}
+
+void World::removeFromChunk(uint32_t index, sf::Vector2i pos)
+{
+    int chunkIndex = getChunkIndex(pos);
+    auto& chunkCells = allocateTile(chunkIndex).cells[chunkIndex % CHUNK_TILE_AREA * settings.numTeams +
+                                                      cells.teamId[index]];
+    uint32_t slot = cells.chunkSlot[index];
+
+    CellHandle last = chunkCells.back();
+    chunkCells[slot] = last;
+    cells.chunkSlot[cells.indexOf(last)] = slot;
+    chunkCells.pop_back();
+
+    if (chunkCells.empty())
+    {
+        spareCellLists.emplace_back();
+        spareCellLists.back().swap(chunkCells);
+    }
+}
+
+void World::updateTeamTotals(uint32_t index, int sign)
+{
+    auto& totals = teamTotals[cells.teamId[index]];
+    totals.cellCount += sign;
+    if (totals.cellCount == 0)
+    {
+        // Drop any rounding error left over from the additions and removals
+        totals = {0, 0, 0, 0, 0, totals.ownedChunks};
+        return;
+    }
+
+    totals.attack += sign * (double) cells.attack[index];
+    totals.defense += sign * (double) cells.defense[index];
+    totals.speed += sign * (double) cells.speed[index];
+    totals.metabolism += sign * (double) cells.metabolism[index];
 }
 
 sf::Vector2i World::worldToChunkPos(sf::Vector2f position) const
@@ -407,18 +783,10 @@ sf::Vector2i World::worldToChunkPos(sf::Vector2f position) const
     return {cx, cy};
 }
 
-void World::updateCellPosition(const std::shared_ptr<Cell>& cell, sf::Vector2f newPosition)
+void World::moveCellChunk(uint32_t index, sf::Vector2i from, sf::Vector2i to)
 {
-    auto oldChunkPos = worldToChunkPos(cell->position);
-    auto newChunkPos = worldToChunkPos(newPosition);
-    cell->position = newPosition;
-    if (newChunkPos != oldChunkPos)
-    {
-        auto& oldCells = getChunk(oldChunkPos)->cells[cell->teamId];
-        auto& newCells = getChunk(newChunkPos)->cells[cell->teamId];
-        newCells.push_back(cell);
-        oldCells.erase(std::find(oldCells.begin(), oldCells.end(), cell));
-    }
+    removeFromChunk(index, from);
+    insertIntoChunk(index, to);
 }
 
 void World::floodClaim(sf::Vector2i center, int maxIters, int teamId)
@@ -435,9 +803,9 @@ void World::floodClaim(sf::Vector2i center, int maxIters, int teamId)
         if (!inBoundsEx(p, {0, 0}, settings.numChunks))
             continue;
 
-        auto &chunk = getChunk(p);
-        if (chunk->getCurrentOwner() != -1) continue;
-        chunk->teamOwnership[teamId] = 1.f;
+        int index = getChunkIndex(p);
+        if (getTile(index).owner[index % CHUNK_TILE_AREA] != -1) continue;
+        setOwnership(index, teamId, 1.f);
         stack->push_back(sf::Vector2i(p.x + 1, p.y));
         stack->push_back(sf::Vector2i(p.x - 1, p.y));
         stack->push_back(sf::Vector2i(p.x, p.y + 1));
@@ -446,141 +814,124 @@ void World::floodClaim(sf::Vector2i center, int maxIters, int teamId)
     }
 }
 
-std::shared_ptr<Cell> World::findNearestEnemies(const Cell& cell, float maxDistance)
+void World::setOwnership(int index, int teamId, float ownership)
 {
-    int searchDistance = (int) ceilf(maxDistance / settings.pixelsPerChunk);
+    int local = index % CHUNK_TILE_AREA;
+    // Leaves unallocated tiles alone when clearing ownership they never had
+    if (getTile(index).ownership[local * settings.numTeams + teamId] == ownership) return;
 
-    sf::Vector2i chunkPos = worldToChunkPos(cell.position);
+    auto& tile = allocateTile(index);
+    tile.ownership[local * settings.numTeams + teamId] = ownership;
 
-    std::shared_ptr<Cell> bestMatch = nullptr;
-    float bestMatchDist = maxDistance;
+    uint64_t bit = (uint64_t) 1 << teamId;
+    uint64_t full = ownership == 1.f ? tile.full[local] | bit : tile.full[local] & ~bit;
+    uint64_t claimed = ownership != 0.f ? tile.claimed[local] | bit : tile.claimed[local] & ~bit;
+    if (full == tile.full[local] && claimed == tile.claimed[local]) return;
 
-    for (int ox = -searchDistance; ox <= searchDistance; ox++)
+    tile.claimed[local] = claimed;
+    int owner = tile.getCurrentOwner(local);
+    if (owner != tile.owner[local])
     {
-        for (int oy = -searchDistance; oy <= searchDistance; oy++)
-        {
-            sf::Vector2i offsetPos = {ox + chunkPos.x, oy + chunkPos.y};
-            if (!inBoundsEx(offsetPos, {0, 0}, settings.numChunks))
-                continue;
-
-            auto& chunk = getChunk(offsetPos);
-            for (int i = 0; i < settings.numTeams; i++)
-            {
-                if (i == cell.teamId) continue;
-
-                for (auto& otherCell: chunk->cells[i])
-                {
-                    auto cellOffset = otherCell->position - cell.position;
-                    auto cellDistance = sqrtf(cellOffset.x * cellOffset.x + cellOffset.y * cellOffset.y);
+        if (tile.owner[local] != -1) teamTotals[tile.owner[local]].ownedChunks--;
+        if (owner != -1) teamTotals[owner].ownedChunks++;
+        tile.owner[local] = owner;
+    }
+    if (full == tile.full[local]) return;
 
-                    if (cellDistance < bestMatchDist)
-                    {
-                        bestMatch = otherCell;
-                        bestMatchDist = cellDistance;
-                    }
-                }
-            }
-        }
+    tile.full[local] = full;
+    sf::Vector2i pos = getChunkPos(index);
+    for (auto offset: {sf::Vector2i(1, 0), sf::Vector2i(-1, 0), sf::Vector2i(0, 1), sf::Vector2i(0, -1)})
+    {
+        if (inBoundsEx(pos + offset, {0, 0}, settings.numChunks))
+            updateChunkMasks(pos + offset);
     }
-    return bestMatch;
 }
 
-std::shared_ptr<Cell> World::findNearestFriendly(const Cell& cell, float maxDistance)
+void World::updateChunkMasks(sf::Vector2i pos)
 {
-    int searchDistance = (int) ceilf(maxDistance / settings.pixelsPerChunk);
-
-    sf::Vector2i chunkPos = worldToChunkPos(cell.position);
-
-    std::shared_ptr<Cell> bestMatch = nullptr;
-    float bestMatchDist = maxDistance;
-
-    for (int ox = -searchDistance; ox <= searchDistance; ox++)
+    uint64_t anyFull = 0;
+    uint64_t allFull = ~(uint64_t) 0;
+    for (auto offset: {sf::Vector2i(1, 0), sf::Vector2i(-1, 0), sf::Vector2i(0, 1), sf::Vector2i(0, -1)})
     {
-        for (int oy = -searchDistance; oy <= searchDistance; oy++)
-        {
-            sf::Vector2i offsetPos = {ox + chunkPos.x, oy + chunkPos.y};
-            if (!inBoundsEx(offsetPos, {0, 0}, settings.numChunks))
-                continue;
-
-            auto& chunk = getChunk(offsetPos);
-            for (int i = 0; i < settings.numTeams; i++)
-            {
-                if (i != cell.teamId) continue;
+        if (!inBoundsEx(pos + offset, {0, 0}, settings.numChunks)) continue;
+        int neighbor = getChunkIndex(pos + offset);
+        uint64_t full = getTile(neighbor).full[neighbor % CHUNK_TILE_AREA];
+        anyFull |= full;
+        allFull &= full;
+    }
 
-                for (auto& otherCell: chunk->cells[i])
-                {
-                    auto cellOffset = otherCell->position - cell.position;
-                    auto cellDistance = sqrtf(cellOffset.x * cellOffset.x + cellOffset.y * cellOffset.y);
+    // Chunks of unallocated tiles border no fully owned chunk already
+    int index = getChunkIndex(pos);
+    if (anyFull == 0 && &getTile(index) == emptyTile.get()) return;
 
-                    if (cellDistance < bestMatchDist)
-                    {
-                        bestMatch = otherCell;
-                        bestMatchDist = cellDistance;
-                    }
-                }
-            }
-        }
-    }
-    return bestMatch;
+    auto& tile = allocateTile(index);
+    tile.claimable[index % CHUNK_TILE_AREA] = anyFull;
+    tile.edge[index % CHUNK_TILE_AREA] = anyFull & ~allFull;
 }
 
-const std::unique_ptr<Chunk>& World::getChunk(sf::Vector2i position) const
+int World::findNearestEnemies(uint32_t index, float maxDistance)
 {
-    return this->chunks[position.x + position.y * settings.numChunks.x];
+    return spatialIndex.findNearest(cells.position[index], cells.teamId[index], true, maxDistance, (int) index);
 }
 
-bool World::isEdge(sf::Vector2i p, int teamId)
+int World::findNearestFriendly(uint32_t index, float maxDistance)
 {
-    bool friendlyConnected = false;
-    bool enemyConnected = false;
-
-    if(p.x + 1 < settings.numChunks.x)
-    {
-        if (getChunk({p.x + 1, p.y})->teamOwnership[teamId] == 1.f)
-            friendlyConnected = true;
-        else enemyConnected = true;
-    }
+    return spatialIndex.findNearest(cells.position[index], cells.teamId[index], false, maxDistance, (int) index);
+}
 
-    if(p.x - 1 >= 0)
+ChunkTile& World::allocateTile(int index)
+{
+    auto& tile = tiles[index / CHUNK_TILE_AREA];
+    if (!tile)
     {
-        if (getChunk({p.x - 1, p.y})->teamOwnership[teamId] == 1.f)
-            friendlyConnected = true;
-        else enemyConnected = true;
+        if (spareTiles.empty())
+        {
+            tile = std::make_unique<ChunkTile>(settings.numTeams);
+        }
+        else
+        {
+            tile = std::move(spareTiles.back());
+            spareTiles.pop_back();
+        }
+        allocatedTiles.push_back(index / CHUNK_TILE_AREA);
     }
+    return *tile;
+}
 
-    if(friendlyConnected && enemyConnected) return true;
-
-    if(p.y + 1 < settings.numChunks.y)
-    {
-        if (getChunk({p.x, p.y + 1})->teamOwnership[teamId] == 1.f)
-            friendlyConnected = true;
-        else enemyConnected = true;
-    }
+const std::vector<CellHandle>& World::getCellList(int index, int teamId) const
+{
+    static const std::vector<CellHandle> noCells;
 
-    if(friendlyConnected && enemyConnected) return true;
+    auto& tile = getTile(index);
+    if (tile.cells.empty()) return noCells;
+    return tile.cells[index % CHUNK_TILE_AREA * settings.numTeams + teamId];
+}
 
-    if(p.y - 1 >= 0)
-    {
-        if (getChunk({p.x, p.y - 1})->teamOwnership[teamId] == 1.f)
-            friendlyConnected = true;
-        else enemyConnected = true;
-    }
+int World::getChunkIndex(sf::Vector2i position) const
+{
+    int tileIndex = (position.x >> CHUNK_TILE_BITS) + (position.y >> CHUNK_TILE_BITS) * numTiles.x;
+    int local = (position.x & (CHUNK_TILE_SIZE - 1)) + (position.y & (CHUNK_TILE_SIZE - 1)) * CHUNK_TILE_SIZE;
+    return tileIndex * CHUNK_TILE_AREA + local;
+}
 
-    return friendlyConnected && enemyConnected;
+sf::Vector2i World::getChunkPos(int index) const
+{
+    int tileIndex = index / CHUNK_TILE_AREA;
+    int local = index % CHUNK_TILE_AREA;
+    return {(tileIndex % numTiles.x) * CHUNK_TILE_SIZE + local % CHUNK_TILE_SIZE,
+            (tileIndex / numTiles.x) * CHUNK_TILE_SIZE + local / CHUNK_TILE_SIZE};
 }
 
-bool World::isClaimable(sf::Vector2i p, int teamId)
+bool World::isEdge(sf::Vector2i p, int teamId) const
 {
-    if(p.x + 1 < settings.numChunks.x && getChunk({p.x + 1, p.y})->teamOwnership[teamId] == 1.f)
-        return true;
-    if(p.x - 1 >= 0 && getChunk({p.x - 1, p.y})->teamOwnership[teamId] == 1.f)
-        return true;
-    if(p.y + 1 < settings.numChunks.y && getChunk({p.x, p.y + 1})->teamOwnership[teamId] == 1.f)
-        return true;
-    if(p.y - 1 >= 0 && getChunk({p.x, p.y - 1})->teamOwnership[teamId] == 1.f)
-        return true;
+    int index = getChunkIndex(p);
+    return getTile(index).edge[index % CHUNK_TILE_AREA] >> teamId & 1;
+}
 
-    return false;
+bool World::isClaimable(sf::Vector2i p, int teamId) const
+{
+    int index = getChunkIndex(p);
+    return getTile(index).claimable[index % CHUNK_TILE_AREA] >> teamId & 1;
 }
 
 //
@@ -588,219 +939,646 @@ bool World::isClaimable(sf::Vector2i p, int teamId)
 //
 
 World::World(WorldSettings settings, int seed) :
-        settings(std::move(settings)), pool((int) std::thread::hardware_concurrency()),
-        generator(seed)
+        World(std::move(settings), seed, nullptr)
 {
-    this->settings.numChunks.x = (int) ceilf((float) this->settings.width / (float) this->settings.pixelsPerChunk);
-    this->settings.numChunks.y = (int) ceilf((float) this->settings.height / (float) this->settings.pixelsPerChunk);
+}
 
-    walkOrder.reserve(this->settings.numChunks.x * this->settings.numChunks.y);
-    for (int x = 0; x < this->settings.numChunks.x; x++)
-    {
-        for (int y = 0; y < this->settings.numChunks.y; y++)
-        {
-            walkOrder.emplace_back(x, y);
-        }
-    }
-    for (int i = 0; i < walkOrder.size() - 1; i++)
+World::World(WorldSettings settings, int seed, ctpl::thread_pool& sharedPool) :
+        World(std::move(settings), seed, &sharedPool)
+{
+}
+
+World::World(WorldSettings settings, int seed, ctpl::thread_pool* sharedPool) :
+        settings(std::move(settings)), seed((uint64_t) seed),
+        ownedPool(sharedPool ? nullptr : std::make_unique<ctpl::thread_pool>()),
+        pool(sharedPool ? *sharedPool : *ownedPool)
+{
+    checkSpawns();
+
+    // The stepping thread works alongside the pool, so it counts towards numThreads.
+    if (ownedPool)
     {
-        std::uniform_int_distribution<int> indexDistrib(i, (int) walkOrder.size() - 1);
-        auto randIdx = indexDistrib(generator);
-        auto temp = walkOrder[randIdx];
-        walkOrder[randIdx] = walkOrder[i];
-        walkOrder[i] = temp;
+        int numThreads = this->settings.numThreads > 0 ? this->settings.numThreads :
+                (int) std::thread::hardware_concurrency();
+        pool.resize(std::max(0, numThreads - 1));
     }
+    moveBuffers.resize(pool.size() + 1);
+    damageBuffers.resize(pool.size() + 1);
 
-    chunks = std::vector<std::unique_ptr<Chunk>>(this->settings.numChunks.x * this->settings.numChunks.y);
-    for (int i = 0; i < chunks.size(); i++)
-        // Set isASpawn to false initially, will be updated
-        chunks[i] = std::make_unique<Chunk>(this->settings.numTeams, false);
+    this->settings.numChunks.x = (int) ceilf((float) this->settings.width / (float) this->settings.pixelsPerChunk);
+    this->settings.numChunks.y = (int) ceilf((float) this->settings.height / (float) this->settings.pixelsPerChunk);
 
-    this->territoryMap->create(this->settings.numChunks.x, this->settings.numChunks.y);
+    numTiles.x = (this->settings.numChunks.x + CHUNK_TILE_SIZE - 1) / CHUNK_TILE_SIZE;
+    numTiles.y = (this->settings.numChunks.y + CHUNK_TILE_SIZE - 1) / CHUNK_TILE_SIZE;
+    tiles.resize(numTiles.x * numTiles.y);
+    emptyTile = std::make_unique<ChunkTile>(this->settings.numTeams);
+
+    chunkSupplyGeneration.resize(tiles.size() * CHUNK_TILE_AREA);
+    teamTotals.resize(this->settings.numTeams);
+    territoryCellCounts.resize(this->settings.numTeams);
+    territoryTargets.resize(this->settings.numTeams);
+    numOverlayTiles.x = (this->settings.numChunks.x + OVERLAY_TILE_CHUNKS - 1) / OVERLAY_TILE_CHUNKS;
+    numOverlayTiles.y = (this->settings.numChunks.y + OVERLAY_TILE_CHUNKS - 1) / OVERLAY_TILE_CHUNKS;
+    overlayTiles.resize(numOverlayTiles.x * numOverlayTiles.y);
+
+    float bucketSize = this->settings.cellAttackRange > 0 ? this->settings.cellAttackRange : this->settings.pixelsPerChunk;
+    spatialIndex.resize({(float) this->settings.width, (float) this->settings.height}, bucketSize,
+                        this->settings.numTeams);
+
+    buildStepGraph();
+    generate();
+}
 
+void World::checkSpawns() const
+{
+    // Initial cells land anywhere within spawnRadius of their spawn, and must land in a chunk
+    bool valid = settings.teamSpawns.size() >= (size_t) settings.numTeams;
+    for (int i = 0; valid && i < settings.numTeams; i++)
+    {
+        sf::Vector2f spawn = settings.teamSpawns[i];
+        valid = spawn.x - settings.spawnRadius >= 0 && spawn.x + settings.spawnRadius < (float) settings.width &&
+                spawn.y - settings.spawnRadius >= 0 && spawn.y + settings.spawnRadius < (float) settings.height;
+    }
+    if (valid) return;
 
-    for(int i = 0; i < this->settings.numTeams; i++)
-        floodClaim(worldToChunkPos(this->settings.teamSpawns[i]), 50, i);
-    for(int x = 0; x < this->settings.numChunks.x; x++)
+    std::cerr << "Every team needs a spawn circle inside the " << settings.width << "x" << settings.height
+              << " world" << std::endl;
+    std::abort();
+}
+
+void World::generate()
+{
+    for(int i = 0; i < settings.numTeams; i++)
+        floodClaim(worldToChunkPos(settings.teamSpawns[i]), 50, i);
+    for(int tileIndex: allocatedTiles)
     {
-        for(int y = 0; y < this->settings.numChunks.y; y++)
-        {
-            auto& chunk = getChunk({x, y});
-            if(chunk->getCurrentOwner() != -1) chunk->development = 1.f;
-            updateTerritoryColor({x, y}, chunk);
-        }
+        auto& tile = *tiles[tileIndex];
+        for(int i = 0; i < CHUNK_TILE_AREA; i++)
+            if(tile.owner[i] != -1) tile.development[i] = 1.f;
     }
 
-    std::uniform_real_distribution<float> angleDistrib(0.f, PI_f * 2);
-    std::uniform_real_distribution<float> distrib01(0.f, 1);
-    std::uniform_real_distribution<float> velocityDistrib(-1.f, 1);
-    std::uniform_int_distribution<int> seedDistrib(-(1 << 30), 1 << 30);
-    for (int teamId = 0; teamId < this->settings.numTeams; teamId++)
+    Random random(seed, INITIAL_CELL_STREAM);
+    for (int teamId = 0; teamId < settings.numTeams; teamId++)
     {
-        for (int i = 0; i < this->settings.initialCellsPerTeam; i++)
+        for (int i = 0; i < settings.initialCellsPerTeam; i++)
         {
-            float angle = angleDistrib(this->generator);
-            float dist = sqrtf(distrib01(this->generator)) * this->settings.spawnRadius;
+            float angle = random.uniform(0.f, PI_f * 2);
+            float dist = sqrtf(random.uniform(0.f, 1.f)) * settings.spawnRadius;
 
             sf::Vector2f position = {
-                    cosf(angle) * dist + this->settings.teamSpawns[teamId].x,
-                    sinf(angle) * dist + this->settings.teamSpawns[teamId].y
+                    cosf(angle) * dist + settings.teamSpawns[teamId].x,
+                    sinf(angle) * dist + settings.teamSpawns[teamId].y
             };
 
-            sf::Vector2f velocity = {velocityDistrib(generator), velocityDistrib(generator)};
+            sf::Vector2f velocity = {random.uniform(-1.f, 1.f), random.uniform(-1.f, 1.f)};
             sf::Vector2f prefferedVelocity = {cosf(angle), sinf(angle)};
 
-            float targetSupply = distrib01(generator) > 0.5 ? 1.f : 3.f;
-
-            auto c = std::make_shared<Cell>(teamId, seedDistrib(generator),
-                                            0.25f, 0.25f, 0.25f, 0.25f,
-                                            1, 1, targetSupply, velocity,
-                                            prefferedVelocity, position);
+            float targetSupply = random.uniform(0.f, 1.f) > 0.5 ? 1.f : 3.f;
 
-            sf::Vector2i chunkPos = worldToChunkPos(c->position);
-            this->cells.push_back(c);
-            auto& chunk = this->getChunk(chunkPos);
-            chunk->cells[c->teamId].push_back(c);
+            addCell(Cell(teamId, random.uniformInt(-(1 << 30), 1 << 30),
+                         0.25f, 0.25f, 0.25f, 0.25f,
+                         1, 1, targetSupply, velocity,
+                         prefferedVelocity, position));
 
-            //if (chunk->teamOwnership[c->teamId] != 1.f)
+            //if (chunk->teamOwnership[teamId] != 1.f)
             //{
-            //    for (int k = 0; k < this->settings.numTeams; k++)
-            //        chunk->teamOwnership[k] = k == c->teamId ? 1.f : 0.f;
+            //    for (int k = 0; k < settings.numTeams; k++)
+            //        chunk->teamOwnership[k] = k == teamId ? 1.f : 0.f;
             //}
         }
     }
 
-    for (const auto& chunk: chunks)
+    // Drawn in row order, whatever the storage order
+    Random chunkRandom(seed, CHUNK_STREAM);
+    for (int y = 0; y < settings.numChunks.y; y++)
+    {
+        for (int x = 0; x < settings.numChunks.x; x++)
+        {
+            float& supplyGeneration = chunkSupplyGeneration[getChunkIndex({x, y})];
+            bool isCity = chunkRandom.uniform(0.f, 1.f) > 0.98f;
+            bool isMegapolis = isCity && chunkRandom.uniform(0.f, 1.f) > 0.99f;
+            supplyGeneration = chunkRandom.uniform(0.f, 1.f) * 0.1f;
+            if(isCity)
+                supplyGeneration *= 10.f;
+            if(isMegapolis)
+                supplyGeneration *= 10.f;
+
+            if(supplyGeneration > maxSupplyGeneration)
+                maxSupplyGeneration = supplyGeneration;
+        }
+    }
+}
+
+void World::reset(int seed)
+{
+    this->seed = (uint64_t) seed;
+    worldTime = 0;
+    maxSupplyGeneration = -1.f;
+    phaseTimes.fill(0);
+
+    cells.reset(0);
+    clearChunks();
+    std::fill(teamTotals.begin(), teamTotals.end(), TeamTotals());
+
+    generate();
+}
+
+void World::clearChunks()
+{
+    for (int tileIndex: allocatedTiles)
     {
-        bool isCity = distrib01(generator) > 0.98f;
-        bool isMegapolis = isCity && distrib01(generator) > 0.99f;
-        chunk->supplyGeneration = distrib01(generator) * 0.1f;
-        if(isCity)
-            chunk->supplyGeneration *= 10.f;
-        if(isMegapolis)
-            chunk->supplyGeneration *= 10.f;
+        tiles[tileIndex]->clear();
+        spareTiles.push_back(std::move(tiles[tileIndex]));
+    }
+    allocatedTiles.clear();
+    activeChunks.clear();
 
-        if(chunk->supplyGeneration > maxSupplyGeneration)
-            maxSupplyGeneration = chunk->supplyGeneration;
+    // Recolor every overlay tile when next drawn
+    for (auto& tile: overlayTiles)
+    {
+        tile.dirtyTerritories.clear();
+        tile.mode = -1;
     }
 }
 
 void World::step(float delta)
 {
+    TRACE_SCOPE("step");
     delta *= settings.speed;
 
     this->worldTime += delta;
 
-    updateTerritories(delta);
-    developChunks(delta);
-    updateChunkSupply(delta);
-    updateCellSupply(delta);
-    updateVelocities(delta);
-    updatePositions(delta);
-    attackNearby(delta);
-    spawnChildren(delta);
+    if (checkPhaseAccess)
+    {
+        // Nodes were added in an order the graph allows
+        for (int node = 0; node < stepGraph.size(); node++)
+            checkStepNode(node, delta);
+    }
+    else
+    {
+        stepGraph.reset();
+        runStepNodes(stepGraph.getRoots().data(), stepGraph.getRoots().size(), delta);
+    }
+    removeKilledCells();
+
+    cellListReserve = std::max((size_t) 4, peakCellListSize);
+    peakCellListSize = 0;
+
+#ifndef NDEBUG
+    checkChunkMembership();
+#endif
 }
 
-void World::draw(sf::RenderTarget& target, sf::RenderStates states) const
+void World::checkChunkMembership() const
 {
-    sf::CircleShape circle(settings.cellRadius, 8);
-    circle.setOrigin(settings.cellRadius, settings.cellRadius);
+    size_t numListed = 0;
+    for (int tileIndex: allocatedTiles)
+        for (auto& teamCells: tiles[tileIndex]->cells)
+            numListed += teamCells.size();
 
-    if (viewMode == ViewMode::DEFAULT)
+    bool consistent = numListed == cells.size();
+    for (size_t i = 0; i < cells.size() && consistent; i++)
     {
-        sf::Texture t = sf::Texture();
-        t.loadFromImage(*this->territoryMap);
-        sf::Sprite sprite(t);
-        sprite.setScale(settings.pixelsPerChunk, settings.pixelsPerChunk);
+        auto& chunkCells = getCellList(getChunkIndex(worldToChunkPos(cells.position[i])), cells.teamId[i]);
+        uint32_t slot = cells.chunkSlot[i];
+        consistent = cells.indexOf(cells.handle[i]) == i && slot < chunkCells.size() &&
+                chunkCells[slot] == cells.handle[i];
 
-        target.draw(sprite, states);
+        if (!consistent)
+            std::cerr << "Cell " << i << " is missing from its chunk, or its slot is stale" << std::endl;
     }
-    else if (viewMode == ViewMode::SUPPLY)
+
+    if (numListed != cells.size())
+        std::cerr << "Chunks list " << numListed << " cells, the store holds " << cells.size() << std::endl;
+
+    if (!consistent) std::abort();
+}
+
+void World::buildStepGraph()
+{
+    // Scratch used by a single node, like the steering of updateVelocities or the spatial index of attackNearby,
+    // isn't a resource. Both halves of UPDATE_CELL_SUPPLY write CHUNK_DEMAND, so they never run at once and time
+    // their phase in turn.
+    stepGraph.add("updateTerritories", UPDATE_TERRITORIES, &World::updateTerritories,
+                  CHUNK_CELLS, CHUNK_OWNERSHIP | ACTIVE_CHUNKS | CHUNK_TILES);
+    stepGraph.add("developChunks", DEVELOP_CHUNKS, &World::developChunks,
+                  CHUNK_TILES | CHUNK_OWNERSHIP, CHUNK_DEVELOPMENT);
+    stepGraph.add("updateChunkSupply", UPDATE_CHUNK_SUPPLY, &World::updateChunkSupply,
+                  CHUNK_TILES | CHUNK_OWNERSHIP | CHUNK_DEVELOPMENT, CHUNK_SUPPLY);
+    stepGraph.add("spendCellSupply", UPDATE_CELL_SUPPLY, &World::spendCellSupply,
+                  CELL_POSITIONS | CELL_STORE | CHUNK_TILES | CHUNK_OWNERSHIP,
+                  CELL_SUPPLY | CELL_HEALTH | CHUNK_CELLS | CHUNK_DEMAND);
+    stepGraph.add("shareChunkSupply", UPDATE_CELL_SUPPLY, &World::shareChunkSupply,
+                  CELL_POSITIONS | CELL_STORE | CHUNK_TILES, CELL_SUPPLY | CHUNK_SUPPLY | CHUNK_DEMAND);
+    stepGraph.add("updateVelocities", UPDATE_VELOCITIES, &World::updateVelocities,
+                  CELL_POSITIONS | CELL_HEALTH | CELL_SUPPLY | CELL_STORE | CHUNK_CELLS | CHUNK_TILES |
+                  CHUNK_OWNERSHIP | CHUNK_SUPPLY, CELL_MOTION);
+    stepGraph.add("updatePositions", UPDATE_POSITIONS, &World::updatePositions,
+                  CELL_HEALTH | CELL_STORE, CELL_POSITIONS | CELL_MOTION | CHUNK_CELLS | ACTIVE_CHUNKS | CHUNK_TILES);
+    stepGraph.add("attackNearby", ATTACK_NEARBY, &World::attackNearby,
+                  CELL_POSITIONS | CELL_SUPPLY | CELL_STORE | CHUNK_TILES, CELL_HEALTH | CHUNK_CELLS);
+    // Adding cells grows every cell field
+    stepGraph.add("spawnChildren", SPAWN_CHILDREN, &World::spawnChildren, 0,
+                  CELL_POSITIONS | CELL_MOTION | CELL_SUPPLY | CELL_HEALTH | CELL_STORE | CHUNK_CELLS |
+                  ACTIVE_CHUNKS | CHUNK_TILES);
+}
+
+void World::runStepNode(int node, float delta)
+{
+    auto& stepNode = stepGraph.getNode(node);
+    TRACE_SCOPE(stepNode.name);
+#ifndef NDEBUG
+    stepGraph.beginNode(node);
+#endif
+
+    if (!timePhases)
     {
-        sf::Image img = sf::Image();
-        img.create(settings.numChunks.x, settings.numChunks.y);
-        for (int x = 0; x < settings.numChunks.x; x++)
-        {
-            for (int y = 0; y < settings.numChunks.y; y++)
-            {
-                auto& chunk = getChunk(sf::Vector2i(x, y));
-                sf::Vector3f colorVec = chunk->supply * sf::Vector3f(255.f, 255.f, 255.f) / (10.f * maxSupplyGeneration);
-                img.setPixel(x, y,sf::Color((uint8_t) colorVec.x, (uint8_t) colorVec.y, (uint8_t) colorVec.z));
-            }
-        }
+        (this->*stepNode.run)(delta);
+    }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        (this->*stepNode.run)(delta);
+        auto end = std::chrono::steady_clock::now();
+        phaseTimes[stepNode.phase] +=
+                (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
 
-        sf::Texture t = sf::Texture();
-        t.loadFromImage(img);
-        sf::Sprite sprite(t);
-        sprite.setScale(settings.pixelsPerChunk, settings.pixelsPerChunk);
+#ifndef NDEBUG
+    stepGraph.endNode(node);
+#endif
+}
 
-        target.draw(sprite, states);
+void World::runStepNodes(const int* nodes, size_t count, float delta)
+{
+    auto run = [&](int node)
+    {
+        runStepNode(node, delta);
+
+        // Whichever predecessor finishes last runs the successor, so no thread waits on another's node
+        int ready[StepGraph::MAX_NODES];
+        size_t numReady = 0;
+        for (int successor: stepGraph.getNode(node).successors)
+            if (stepGraph.finishPredecessor(successor)) ready[numReady++] = successor;
+        if (numReady > 0) runStepNodes(ready, numReady, delta);
+    };
+
+    if (count == 1)
+    {
+        run(nodes[0]);
+        return;
     }
-    else if(viewMode == ViewMode::SUPPLY_GENERATION)
+
+    pool.parallel_for(count, count, [&](size_t task, size_t begin, size_t end)
     {
-        sf::Image img = sf::Image();
-        img.create(settings.numChunks.x, settings.numChunks.y);
-        for (int x = 0; x < settings.numChunks.x; x++)
+        for (size_t i = begin; i < end; i++)
+            run(nodes[i]);
+    });
+}
+
+void World::checkStepNode(int node, float delta)
+{
+    std::array<uint64_t, NUM_STEP_RESOURCES> before;
+    for (int resource = 0; resource < NUM_STEP_RESOURCES; resource++)
+        before[resource] = hashStepResource(resource);
+
+    runStepNode(node, delta);
+
+    auto& stepNode = stepGraph.getNode(node);
+    bool declared = true;
+    for (int resource = 0; resource < NUM_STEP_RESOURCES; resource++)
+    {
+        if (stepNode.writes >> resource & 1 || hashStepResource(resource) == before[resource]) continue;
+        std::cerr << "Phase " << stepNode.name << " changed " << getStepResourceName(resource)
+                  << " without declaring it" << std::endl;
+        declared = false;
+    }
+
+    if (!declared) std::abort();
+}
+
+const std::array<uint64_t, NUM_STEP_PHASES>& World::getPhaseTimes() const
+{
+    return phaseTimes;
+}
+
+void World::resetPhaseTimes()
+{
+    phaseTimes.fill(0);
+}
+
+size_t World::getCellCount() const
+{
+    return cells.size();
+}
+
+void World::draw(sf::RenderTarget& target, sf::RenderStates states) const
+{
+    captureFrame(drawFrame, FrameRenderer::getVisibleArea(target, states.transform));
+    renderer.draw(target, drawFrame, states);
+}
+
+void World::captureFrame(WorldFrame& frame, sf::FloatRect area) const
+{
+    TRACE_SCOPE("captureFrame");
+    frame.size = {(float) settings.width, (float) settings.height};
+    frame.numChunks = settings.numChunks;
+    frame.pixelsPerChunk = (float) settings.pixelsPerChunk;
+    frame.cellRadius = settings.cellRadius;
+    frame.area = area;
+    frame.worldTime = worldTime;
+    frame.teamStats = getTeamStats();
+    frame.numOverlayTiles = numOverlayTiles;
+    frame.overlayTiles.resize(overlayTiles.size());
+    frame.cellPositions.clear();
+    frame.cellColors.clear();
+
+    frame.firstTile = {0, 0};
+    frame.lastTile = {-1, -1};
+    if (!area.intersects(sf::FloatRect(0, 0, (float) settings.width, (float) settings.height)))
+        return;
+
+    frame.firstTile = getClampedChunkPos({area.left, area.top}, settings.pixelsPerChunk, settings.numChunks) /
+                      OVERLAY_TILE_CHUNKS;
+    frame.lastTile = getClampedChunkPos({area.left + area.width, area.top + area.height}, settings.pixelsPerChunk,
+                                        settings.numChunks) / OVERLAY_TILE_CHUNKS;
+
+    for (int y = frame.firstTile.y; y <= frame.lastTile.y; y++)
+    {
+        for (int x = frame.firstTile.x; x <= frame.lastTile.x; x++)
         {
-            for (int y = 0; y < settings.numChunks.y; y++)
-            {
-                auto& chunk = getChunk(sf::Vector2i(x, y));
-                sf::Vector3f colorVec = chunk->getEffectiveSupplyGeneration() * sf::Vector3f(255.f, 255.f, 255.f) / maxSupplyGeneration;
-                img.setPixel(x, y,sf::Color((uint8_t) colorVec.x, (uint8_t) colorVec.y, (uint8_t) colorVec.z));
-            }
+            updateOverlayTile({x, y});
+
+            auto& tile = overlayTiles[x + y * numOverlayTiles.x];
+            auto& frameTile = frame.overlayTiles[x + y * numOverlayTiles.x];
+            if (frameTile.version == tile.version) continue;
+            frameTile.size = {tile.width, (int) tile.pixels.size() / 4 / tile.width};
+            frameTile.pixels = tile.pixels;
+            frameTile.version = tile.version;
         }
+    }
 
-        sf::Texture t = sf::Texture();
-        t.loadFromImage(img);
-        sf::Sprite sprite(t);
-        sprite.setScale(settings.pixelsPerChunk, settings.pixelsPerChunk);
+    captureCells(frame, area);
+}
 
-        target.draw(sprite, states);
-    }
-    // else impossible
+void World::captureCells(WorldFrame& frame, sf::FloatRect area) const
+{
+    TRACE_SCOPE("captureCells");
 
-    for (const auto& c: cells)
+    area = getCellCullArea(area, settings.cellRadius);
+
+    auto appendCell = [&](uint32_t i)
+    {
+        auto color = settings.teamColors[cells.teamId[i]];
+        color.a = (uint8_t) lerp(150.f, 255.f, cells.health[i]);
+        frame.cellPositions.push_back(cells.position[i]);
+        frame.cellColors.push_back(color);
+    };
+
+    sf::Vector2i first = getClampedChunkPos({area.left, area.top}, settings.pixelsPerChunk, settings.numChunks);
+    sf::Vector2i last = getClampedChunkPos({area.left + area.width, area.top + area.height}, settings.pixelsPerChunk,
+                                           settings.numChunks);
+    size_t numVisibleChunks = (size_t) (last.x - first.x + 1) * (size_t) (last.y - first.y + 1);
+
+    if (numVisibleChunks * settings.numTeams < cells.size())
+    {
+        // Zoomed in: walk only the lists of the chunks in the area
+        for (int y = first.y; y <= last.y; y++)
+            for (int x = first.x; x <= last.x; x++)
+                for (int teamId = 0; teamId < settings.numTeams; teamId++)
+                    for (CellHandle handle: getCellList(getChunkIndex({x, y}), teamId))
+                        appendCell(cells.indexOf(handle));
+    }
+    else
     {
-        auto pos = c->position;
-        circle.setPosition(pos);
-        auto color = settings.teamColors[c->teamId];
-        color.a = (uint8_t) lerp(150.f, 255.f, c->health);
-        circle.setFillColor(color);
-        target.draw(circle, states);
+        for (size_t i = 0; i < cells.size(); i++)
+            if (area.contains(cells.position[i]))
+                appendCell((uint32_t) i);
     }
+
+    TRACE_COUNTER("cells", frame.cellPositions.size());
 }
 
 World::~World() {}
 
-std::string World::getStats()
+std::vector<TeamStats> World::getTeamStats() const
+{
+    std::vector<TeamStats> stats(settings.numTeams);
+
+    for(int i = 0; i < settings.numTeams; i++) {
+        auto& totals = teamTotals[i];
+        auto& team = stats[i];
+        team.cellCount = totals.cellCount;
+        team.ownedChunks = totals.ownedChunks;
+
+        // Extinct teams keep zeroed averages
+        if(totals.cellCount == 0) continue;
+
+        team.averageAttack = (float) (totals.attack / totals.cellCount);
+        team.averageDefense = (float) (totals.defense / totals.cellCount);
+        team.averageSpeed = (float) (totals.speed / totals.cellCount);
+        team.averageMetabolism = (float) (totals.metabolism / totals.cellCount);
+    }
+
+    return stats;
+}
+
+std::vector<float> World::getTeamSupply() const
 {
-    std::string output = "";
+    std::vector<float> supply(settings.numTeams);
+    for(size_t i = 0; i < cells.size(); i++)
+        supply[cells.teamId[i]] += cells.supply[i];
+    return supply;
+}
 
-    std::vector<float> averageAttack(settings.numTeams);
-    std::vector<float> averageDefense(settings.numTeams);
-    std::vector<float> averageSpeed(settings.numTeams);
-    std::vector<float> averageMetabolism(settings.numTeams);
-    std::vector<int> teamCounts(settings.numTeams);
+float World::getWorldTime() const
+{
+    return worldTime;
+}
 
-    for(auto& cell : cells) {
-        teamCounts[cell->teamId] += 1;
-        averageAttack[cell->teamId] += cell->attack;
-        averageDefense[cell->teamId] += cell->defense;
-        averageSpeed[cell->teamId] += cell->speed;
-        averageMetabolism[cell->teamId] += cell->metabolism;
+void World::reseed(int seed)
+{
+    this->seed = (uint64_t) seed;
+}
+
+// FNV-1a over the bytes of data
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    auto bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
     }
+}
 
-    for(int i = 0; i < settings.numTeams; i++) {
-        averageAttack[i] /= (float)teamCounts[i];
-        averageDefense[i] /= (float)teamCounts[i];
-        averageSpeed[i] /= (float)teamCounts[i];
-        averageMetabolism[i] /= (float)teamCounts[i];
+template<class T>
+static void hashVector(uint64_t& hash, const std::vector<T>& values)
+{
+    uint64_t size = values.size();
+    hashBytes(hash, &size, sizeof(size));
+    hashBytes(hash, values.data(), values.size() * sizeof(T));
+}
+
+// Hashes one field of an allocated tile along with the tile's index, unless it still equals the field of a tile
+// that was never allocated, so allocating tiles alone doesn't change the hash
+template<class T>
+static void hashTileField(uint64_t& hash, int tileIndex, const T* field, const T* emptyField, size_t size)
+{
+    if (std::equal(field, field + size, emptyField)) return;
+    hashBytes(hash, &tileIndex, sizeof(tileIndex));
+    hashBytes(hash, field, size * sizeof(T));
+}
+
+uint64_t World::hashStepResource(int resource) const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto& empty = *emptyTile;
+    size_t perTeam = CHUNK_TILE_AREA * settings.numTeams;
+
+    switch (1u << resource)
+    {
+        case CELL_POSITIONS:
+            hashVector(hash, cells.position);
+            break;
+        case CELL_MOTION:
+            hashVector(hash, cells.velocity);
+            hashVector(hash, cells.preferredVelocity);
+            break;
+        case CELL_SUPPLY:
+            hashVector(hash, cells.supply);
+            hashVector(hash, cells.childProgress);
+            hashVector(hash, cells.numChildren);
+            break;
+        case CELL_HEALTH:
+            hashVector(hash, cells.health);
+            hashVector(hash, killBuffer);
+            break;
+        case CELL_STORE:
+            hashVector(hash, cells.handle);
+            hashVector(hash, cells.teamId);
+            hashVector(hash, cells.seed);
+            hashVector(hash, cells.attack);
+            hashVector(hash, cells.defense);
+            hashVector(hash, cells.speed);
+            hashVector(hash, cells.metabolism);
+            break;
+        case CHUNK_CELLS:
+            hashVector(hash, cells.chunkSlot);
+            for (int tileIndex: allocatedTiles)
+            {
+                auto& tile = *tiles[tileIndex];
+                for (size_t i = 0; i < tile.cells.size(); i++)
+                {
+                    if (tile.cells[i].empty()) continue;
+                    uint64_t list = (uint64_t) tileIndex * perTeam + i;
+                    hashBytes(hash, &list, sizeof(list));
+                    hashVector(hash, tile.cells[i]);
+                }
+            }
+            for (auto& totals: teamTotals)
+            {
+                hashBytes(hash, &totals.cellCount, sizeof(totals.cellCount));
+                hashBytes(hash, &totals.attack, sizeof(totals.attack));
+                hashBytes(hash, &totals.defense, sizeof(totals.defense));
+                hashBytes(hash, &totals.speed, sizeof(totals.speed));
+                hashBytes(hash, &totals.metabolism, sizeof(totals.metabolism));
+            }
+            break;
+        case ACTIVE_CHUNKS:
+            hashVector(hash, activeChunks);
+            for (int tileIndex: allocatedTiles)
+                hashTileField(hash, tileIndex, tiles[tileIndex]->active, empty.active, CHUNK_TILE_AREA);
+            break;
+        case CHUNK_TILES:
+            hashVector(hash, allocatedTiles);
+            break;
+        case CHUNK_OWNERSHIP:
+            for (int tileIndex: allocatedTiles)
+            {
+                auto& tile = *tiles[tileIndex];
+                hashTileField(hash, tileIndex, tile.ownership.data(), empty.ownership.data(), perTeam);
+                hashTileField(hash, tileIndex, tile.owner, empty.owner, CHUNK_TILE_AREA);
+                hashTileField(hash, tileIndex, tile.full, empty.full, CHUNK_TILE_AREA);
+                hashTileField(hash, tileIndex, tile.claimed, empty.claimed, CHUNK_TILE_AREA);
+                hashTileField(hash, tileIndex, tile.claimable, empty.claimable, CHUNK_TILE_AREA);
+                hashTileField(hash, tileIndex, tile.edge, empty.edge, CHUNK_TILE_AREA);
+                hashTileField(hash, tileIndex, tile.territoryDirty, empty.territoryDirty, CHUNK_TILE_AREA);
+            }
+            for (auto& totals: teamTotals)
+                hashBytes(hash, &totals.ownedChunks, sizeof(totals.ownedChunks));
+            break;
+        case CHUNK_DEVELOPMENT:
+            for (int tileIndex: allocatedTiles)
+                hashTileField(hash, tileIndex, tiles[tileIndex]->development, empty.development, CHUNK_TILE_AREA);
+            break;
+        case CHUNK_SUPPLY:
+            for (int tileIndex: allocatedTiles)
+                hashTileField(hash, tileIndex, tiles[tileIndex]->supply, empty.supply, CHUNK_TILE_AREA);
+            break;
+        case CHUNK_DEMAND:
+            hashVector(hash, supplyDemand);
+            hashVector(hash, demandChunks);
+            for (int tileIndex: allocatedTiles)
+                hashTileField(hash, tileIndex, tiles[tileIndex]->demand, empty.demand, CHUNK_TILE_AREA);
+            break;
+        default:
+            break;
+    }
+    return hash;
+}
 
-        output += std::to_string(averageAttack[i])+',';
-        output += std::to_string(averageDefense[i])+',';
-        output += std::to_string(averageSpeed[i])+',';
-        output += std::to_string(averageMetabolism[i])+'\n';
+uint64_t World::stateHash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hashBytes(hash, &worldTime, sizeof(worldTime));
+
+    // Handles are bookkeeping, not state
+    hashVector(hash, cells.teamId);
+    hashVector(hash, cells.seed);
+    hashVector(hash, cells.attack);
+    hashVector(hash, cells.defense);
+    hashVector(hash, cells.speed);
+    hashVector(hash, cells.metabolism);
+    hashVector(hash, cells.health);
+    hashVector(hash, cells.supply);
+    hashVector(hash, cells.childProgress);
+    hashVector(hash, cells.numChildren);
+    hashVector(hash, cells.velocity);
+    hashVector(hash, cells.preferredVelocity);
+    hashVector(hash, cells.position);
+
+    // Chunks in row order, each field hashed as if it were one vector, so the hash doesn't depend on storage
+    uint64_t numTeams = settings.numTeams;
+    for (int y = 0; y < settings.numChunks.y; y++)
+    {
+        for (int x = 0; x < settings.numChunks.x; x++)
+        {
+            int index = getChunkIndex({x, y});
+            hashBytes(hash, &numTeams, sizeof(numTeams));
+            hashBytes(hash, &getTile(index).ownership[index % CHUNK_TILE_AREA * numTeams], numTeams * sizeof(float));
+        }
+    }
+
+    uint64_t numChunks = (uint64_t) settings.numChunks.x * settings.numChunks.y;
+    hashBytes(hash, &numChunks, sizeof(numChunks));
+    for (int y = 0; y < settings.numChunks.y; y++)
+    {
+        for (int x = 0; x < settings.numChunks.x; x++)
+        {
+            int index = getChunkIndex({x, y});
+            hashBytes(hash, &getTile(index).supply[index % CHUNK_TILE_AREA], sizeof(float));
+        }
+    }
+    hashBytes(hash, &numChunks, sizeof(numChunks));
+    for (int y = 0; y < settings.numChunks.y; y++)
+    {
+        for (int x = 0; x < settings.numChunks.x; x++)
+        {
+            int index = getChunkIndex({x, y});
+            hashBytes(hash, &getTile(index).development[index % CHUNK_TILE_AREA], sizeof(float));
+        }
     }
 
-    return output;
+    return hash;
 }
@@ -0,0 +1,35 @@
+#include "world/world_settings.h"
+#include <algorithm>
+
+WorldSettings WorldSettings::standard(int width, int height)
+{
+    WorldSettings settings;
+    settings.width = width;
+    settings.height = height;
+
+    settings.pixelsPerChunk = 10;
+
+    settings.numTeams = 4;
+    settings.cellRadius = 3;
+    settings.initialCellsPerTeam = 10;
+    settings.cellAttackRange = 10;
+    settings.supplyDiffusionRate = 1.f;
+
+    settings.teamColors = {
+            sf::Color::Green,
+            sf::Color::Red,
+            sf::Color::Yellow,
+            sf::Color::Blue
+    };
+    // 300 units in from the corners, or a third of the way in on small worlds, so the spawns stay inside
+    sf::Vector2f margin = {std::min(300.f, (float) width / 3.f), std::min(300.f, (float) height / 3.f)};
+    settings.teamSpawns = {
+            {margin.x,                 margin.y},
+            {margin.x,                 (float) height - margin.y},
+            {(float) width - margin.x, margin.y},
+            {(float) width - margin.x, (float) height - margin.y}
+    };
+    settings.spawnRadius = 5;
+
+    return settings;
+}